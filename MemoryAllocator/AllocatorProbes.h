@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <type_traits>
+
+//Linux SDT probes, attach with eg bpftrace -e 'usdt:./app:memory_allocator:allocate { @[arg1] = hist(arg0); }' or perf probe sdt_memory_allocator:*.
+//An unattached probe is a single nop. Without <sys/sdt.h>, or with MEMORY_ALLOCATOR_NO_PROBES defined, they compile away and their arguments
+//aren't evaluated. Every probe takes (bytes, class index, address):
+//	allocate		Block or large allocation handed out, class is the class the block came from
+//	free			Block or large allocation returned
+//	pool_add		Pool platform memory allocated
+//	pool_release	Pool platform memory freed, either trimmed or released by decay
+//	budget_hit		The budget couldn't cover a request before trimming, address is the committed bytes at the time
+//Allocations too large for any class report SizeClassTable::kInvalidClass. Addresses are offsets for allocators handing out integers.
+#if defined(__linux__) && defined(__has_include) && !defined(MEMORY_ALLOCATOR_NO_PROBES)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MEMORY_ALLOCATOR_PROBES 1
+#endif
+#endif
+
+#if defined(MEMORY_ALLOCATOR_PROBES)
+#define MEMORY_ALLOCATOR_PROBE(name, bytes, classIdx, address) DTRACE_PROBE3(memory_allocator, name, static_cast<uint64_t>(bytes), static_cast<uint64_t>(classIdx), ::Templated::ProbeAddress(address))
+#else
+//Arguments are named in an unevaluated operand so parameters only the probes read don't trip -Wunused-parameter
+#define MEMORY_ALLOCATOR_PROBE(name, bytes, classIdx, address) ((void)sizeof(static_cast<uint64_t>(bytes) + static_cast<uint64_t>(classIdx) + ::Templated::ProbeAddress(address)))
+#endif
+
+namespace Templated
+{
+	template<typename T_MEMORY>
+	inline uint64_t ProbeAddress(T_MEMORY memory)
+	{
+		if constexpr (std::is_pointer<T_MEMORY>::value)
+			return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(memory));
+		else
+			return static_cast<uint64_t>(memory);
+	}
+}
@@ -0,0 +1,434 @@
+#include "Benchmarks.h"
+#include "PlatformAllocators.h"
+#include "CoroutineFrameAllocator.h"
+#include "IoBufferAllocator.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+#if BENCHMARKS_COROUTINES
+#include <coroutine>
+#endif
+#if BENCHMARKS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <random>
+#endif
+
+namespace Benchmarks
+{
+	namespace
+	{
+		using Clock = std::chrono::steady_clock;
+
+		double NanosecondsPer(Clock::duration elapsed, size_t count)
+		{
+			return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / static_cast<double>(count);
+		}
+
+		//Every pool holds a hot object in block 0, walk those objects over and over
+		double WalkHotBlocks(bool bColoring)
+		{
+			constexpr size_t kPoolCount = 512;
+			constexpr size_t kBlocksPerPool = 16;
+			constexpr size_t kPasses = 2000;
+
+			using Allocator = Templated::MemoryAllocator<Templated::MMapAllocator>;
+			Templated::MMapAllocator platformAllocator;
+			Allocator allocator(platformAllocator, Templated::SizeClassTable(std::vector<Templated::PoolSizeConstructor>{ { 256, kBlocksPerPool } }));
+
+			Templated::ColoringPolicy coloringPolicy;
+			coloringPolicy.m_bEnabled = bColoring;
+			allocator.SetColoringPolicy(coloringPolicy);
+
+			std::vector<Allocator::Memory> allocations;
+			std::vector<volatile uint64_t*> hotObjects;
+			allocations.reserve(kPoolCount * kBlocksPerPool);
+			for (size_t i = 0; i < kPoolCount * kBlocksPerPool; i++)
+			{
+				allocations.push_back(allocator.Allocate(256, Templated::CPPAllocator::Type::Other));
+				memset(allocations.back()->m_platformMemory, 0, 256);
+				if (i % kBlocksPerPool == 0)
+					hotObjects.push_back(static_cast<volatile uint64_t*>(allocations.back()->m_platformMemory));
+			}
+
+			const auto start = Clock::now();
+			for (size_t pass = 0; pass < kPasses; pass++)
+			{
+				for (auto* hotObject : hotObjects)
+					*hotObject = *hotObject + 1;
+			}
+			return NanosecondsPer(Clock::now() - start, kPasses * hotObjects.size());
+		}
+
+		//Each thread allocates one block in turn, so without thread owned slabs neighbouring threads get neighbouring blocks
+		double WriteOwnBlocks(bool bThreadSlabs, size_t threadCount)
+		{
+			constexpr size_t kBlockSize = 96;
+			constexpr size_t kWrites = 4000000;
+
+			using Allocator = Templated::MemoryAllocator<Templated::CPPAllocator>;
+			Templated::CPPAllocator platformAllocator;
+			Allocator allocator(platformAllocator, Templated::SizeClassTable(std::vector<Templated::PoolSizeConstructor>{ { kBlockSize, 1024 } }));
+
+			Templated::ThreadSlabPolicy threadSlabPolicy;
+			threadSlabPolicy.m_bEnabled = bThreadSlabs;
+			allocator.SetThreadSlabPolicy(threadSlabPolicy);
+
+			std::atomic<size_t> allocationTurn{ 0 };
+			std::atomic<size_t> readyCount{ 0 };
+			std::atomic<bool> bGo{ false };
+			std::vector<Allocator::Memory> allocations(threadCount);
+			std::vector<std::thread> threads;
+			for (size_t t = 0; t < threadCount; t++)
+			{
+				threads.emplace_back([&, t]()
+				{
+					while (allocationTurn.load() != t)
+						std::this_thread::yield();
+					allocations[t] = allocator.Allocate(kBlockSize, Templated::CPPAllocator::Type::Other);
+					volatile uint64_t* pFirst = static_cast<uint64_t*>(allocations[t]->m_platformMemory);
+					volatile uint64_t* pLast = pFirst + kBlockSize / sizeof(uint64_t) - 1;
+					allocationTurn++;
+
+					readyCount++;
+					while (!bGo.load())
+						std::this_thread::yield();
+					for (size_t i = 0; i < kWrites; i++)
+					{
+						*pFirst = *pFirst + 1;
+						*pLast = *pLast + 1;
+					}
+				});
+			}
+
+			while (readyCount.load() != threadCount)
+				std::this_thread::yield();
+			const auto start = Clock::now();
+			bGo = true;
+			for (auto& thread : threads)
+				thread.join();
+			return NanosecondsPer(Clock::now() - start, kWrites);
+		}
+
+#if BENCHMARKS_IO_URING
+		//Just enough io_uring to submit one read at a time and wait for it, without depending on liburing
+		class ReadRing
+		{
+		public:
+			~ReadRing()
+			{
+				if (m_sqes != nullptr)
+					munmap(m_sqes, m_sqesBytes);
+				if (m_cqRing != nullptr && m_cqRing != m_sqRing)
+					munmap(m_cqRing, m_cqRingBytes);
+				if (m_sqRing != nullptr)
+					munmap(m_sqRing, m_sqRingBytes);
+				if (m_ringFd >= 0)
+					close(m_ringFd);
+			}
+
+			bool Init(unsigned entries)
+			{
+				io_uring_params params;
+				memset(&params, 0, sizeof(params));
+				m_ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+				if (m_ringFd < 0)
+					return false;
+
+				m_sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+				m_cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+				const bool bSingleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+				if (bSingleMap)
+					m_sqRingBytes = m_cqRingBytes = (std::max)(m_sqRingBytes, m_cqRingBytes);
+				m_sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+
+				m_sqRing = Map(m_sqRingBytes, IORING_OFF_SQ_RING);
+				m_cqRing = bSingleMap ? m_sqRing : Map(m_cqRingBytes, IORING_OFF_CQ_RING);
+				m_sqes = static_cast<io_uring_sqe*>(Map(m_sqesBytes, IORING_OFF_SQES));
+				if (m_sqRing == nullptr || m_cqRing == nullptr || m_sqes == nullptr)
+					return false;
+
+				char* sqRing = static_cast<char*>(m_sqRing);
+				char* cqRing = static_cast<char*>(m_cqRing);
+				m_sqTail = reinterpret_cast<unsigned*>(sqRing + params.sq_off.tail);
+				m_sqMask = *reinterpret_cast<unsigned*>(sqRing + params.sq_off.ring_mask);
+				m_sqArray = reinterpret_cast<unsigned*>(sqRing + params.sq_off.array);
+				m_cqHead = reinterpret_cast<unsigned*>(cqRing + params.cq_off.head);
+				m_cqTail = reinterpret_cast<unsigned*>(cqRing + params.cq_off.tail);
+				m_cqMask = *reinterpret_cast<unsigned*>(cqRing + params.cq_off.ring_mask);
+				m_cqes = reinterpret_cast<io_uring_cqe*>(cqRing + params.cq_off.cqes);
+				return true;
+			}
+
+			bool RegisterBuffers(const Templated::IoVector* buffers, unsigned count)
+			{
+				return syscall(__NR_io_uring_register, m_ringFd, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+			}
+
+			//READ_FIXED when bufferIdx is a registered buffer, a plain READ when it's negative. Returns bytes read or -errno.
+			int Read(int fileFd, void* pBuffer, unsigned bytes, uint64_t offset, int bufferIdx)
+			{
+				const unsigned tail = *m_sqTail;
+				const unsigned sqeIdx = tail & m_sqMask;
+				io_uring_sqe& sqe = m_sqes[sqeIdx];
+				memset(&sqe, 0, sizeof(sqe));
+				sqe.opcode = bufferIdx >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+				sqe.fd = fileFd;
+				sqe.addr = reinterpret_cast<uint64_t>(pBuffer);
+				sqe.len = bytes;
+				sqe.off = offset;
+				sqe.buf_index = static_cast<uint16_t>(bufferIdx >= 0 ? bufferIdx : 0);
+				m_sqArray[sqeIdx] = sqeIdx;
+				__atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+				if (syscall(__NR_io_uring_enter, m_ringFd, 1, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0)
+					return -1;
+				const unsigned head = *m_cqHead;
+				while (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+					std::this_thread::yield();
+				const int result = m_cqes[head & m_cqMask].res;
+				__atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+				return result;
+			}
+
+		private:
+			void* Map(size_t bytes, off_t offset)
+			{
+				void* pMemory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, offset);
+				return pMemory == MAP_FAILED ? nullptr : pMemory;
+			}
+
+			int m_ringFd = -1;
+			void* m_sqRing = nullptr;
+			void* m_cqRing = nullptr;
+			io_uring_sqe* m_sqes = nullptr;
+			size_t m_sqRingBytes = 0;
+			size_t m_cqRingBytes = 0;
+			size_t m_sqesBytes = 0;
+			unsigned* m_sqTail = nullptr;
+			unsigned m_sqMask = 0;
+			unsigned* m_sqArray = nullptr;
+			unsigned* m_cqHead = nullptr;
+			unsigned* m_cqTail = nullptr;
+			unsigned m_cqMask = 0;
+			io_uring_cqe* m_cqes = nullptr;
+		};
+
+		constexpr size_t kIoFileBytes = 1024 * 1024 * 32;
+		constexpr size_t kIoReadBytes = 1024 * 64;
+		constexpr size_t kIoReads = 20000;
+
+		//Every read takes a fresh buffer and gives it back, as a server handling one request per read would.
+		//Returns ns per read or a negative value when a read fails.
+		template<typename T_ACQUIRE, typename T_RELEASE>
+		double TimeReads(ReadRing& ring, int fileFd, T_ACQUIRE acquire, T_RELEASE release)
+		{
+			std::mt19937_64 random(42);
+			std::uniform_int_distribution<size_t> chunk(0, kIoFileBytes / kIoReadBytes - 1);
+			uint64_t checksum = 0;
+			const auto start = Clock::now();
+			for (size_t i = 0; i < kIoReads; i++)
+			{
+				int bufferIdx = -1;
+				void* pBuffer = acquire(bufferIdx);
+				if (ring.Read(fileFd, pBuffer, kIoReadBytes, chunk(random) * kIoReadBytes, bufferIdx) != static_cast<int>(kIoReadBytes))
+				{
+					release(pBuffer);
+					return -1.0;
+				}
+				checksum += static_cast<uint8_t*>(pBuffer)[0];
+				release(pBuffer);
+			}
+			const auto elapsed = Clock::now() - start;
+			if (checksum == 0)
+				return -1.0;
+			return NanosecondsPer(elapsed, kIoReads);
+		}
+#endif
+
+#if BENCHMARKS_COROUTINES
+		//Smallest task that still owns its frame, destroyed by the caller so the frame can't be elided
+		template<typename T_FRAME_BASE>
+		struct SpawnTask
+		{
+			struct promise_type : T_FRAME_BASE
+			{
+				SpawnTask get_return_object() { return SpawnTask{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+				std::suspend_never initial_suspend() noexcept { return {}; }
+				std::suspend_always final_suspend() noexcept { return {}; }
+				void return_value(uint64_t value) { m_value = value; }
+				void unhandled_exception() { std::terminate(); }
+				uint64_t m_value = 0;
+			};
+
+			explicit SpawnTask(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+			SpawnTask(const SpawnTask&) = delete;
+			SpawnTask& operator=(const SpawnTask&) = delete;
+			~SpawnTask() { m_handle.destroy(); }
+
+			std::coroutine_handle<promise_type> m_handle;
+		};
+
+		struct DefaultFrame {};
+
+		template<typename T_FRAME_BASE>
+		SpawnTask<T_FRAME_BASE> Spawn(uint64_t input)
+		{
+			volatile uint64_t local[8] = {};			//Gives the frame some body, as a real handler's locals would
+			local[input % 8] = input;
+			co_return local[input % 8] + 1;
+		}
+
+		template<typename T_FRAME_BASE>
+		double SpawnCoroutines(size_t spawnCount)
+		{
+			uint64_t sum = 0;
+			const auto start = Clock::now();
+			for (size_t i = 0; i < spawnCount; i++)
+			{
+				SpawnTask<T_FRAME_BASE> task = Spawn<T_FRAME_BASE>(i);
+				sum += task.m_handle.promise().m_value;
+			}
+			const auto elapsed = Clock::now() - start;
+			if (sum == 0)
+				std::terminate();
+			return NanosecondsPer(elapsed, spawnCount);
+		}
+#endif
+	}
+
+	void CacheThrash(std::ostream& output)
+	{
+		const size_t threadCount = (std::max)(std::thread::hardware_concurrency(), 2u);
+		const double shared = WriteOwnBlocks(false, threadCount);
+		const double owned = WriteOwnBlocks(true, threadCount);
+		output << "CacheThrash: " << threadCount << " threads writing their own 96 byte block\n";
+		output << "  shared pools       " << shared << " ns/iteration\n";
+		output << "  thread owned slabs " << owned << " ns/iteration\n";
+		if (std::thread::hardware_concurrency() < 2)
+			output << "  (single hardware thread, no false sharing to remove)\n";
+	}
+
+	void CacheColoring(std::ostream& output)
+	{
+		WalkHotBlocks(false);
+		const double uncolored = WalkHotBlocks(false);
+		const double colored = WalkHotBlocks(true);
+		output << "CacheColoring: 512 pools, block 0 of each\n";
+		output << "  uncoloured " << uncolored << " ns/access\n";
+		output << "  coloured   " << colored << " ns/access\n";
+	}
+
+	void CoroutineSpawn(std::ostream& output)
+	{
+#if BENCHMARKS_COROUTINES
+		constexpr size_t kSpawns = 2000000;
+
+		//Installed for the rest of the program, it must outlive every thread's frame cache
+		using FrameAllocator = Templated::CoroutineFrameAllocator<Templated::CPPAllocator>;
+		static Templated::CPPAllocator platformAllocator;
+		static Templated::MemoryAllocator<Templated::CPPAllocator> allocator(platformAllocator);
+		FrameAllocator::Install(&allocator);
+
+		SpawnCoroutines<DefaultFrame>(kSpawns);
+		const double global = SpawnCoroutines<DefaultFrame>(kSpawns);
+		const double pooled = SpawnCoroutines<Templated::PooledCoroutineFrame<Templated::CPPAllocator>>(kSpawns);
+		FrameAllocator::FlushThreadCache();
+
+		output << "CoroutineSpawn: spawn and destroy a short coroutine\n";
+		output << "  global operator new " << global << " ns/spawn\n";
+		output << "  pooled frames       " << pooled << " ns/spawn\n";
+#else
+		output << "CoroutineSpawn: built without coroutine support\n";
+#endif
+	}
+
+	void IoBufferReads(std::ostream& output)
+	{
+#if BENCHMARKS_IO_URING
+		char path[] = "io_buffer_benchmark_XXXXXX";
+		const int writeFd = mkstemp(path);
+		if (writeFd < 0)
+		{
+			output << "IoBufferReads: couldn't create a file in the working directory\n";
+			return;
+		}
+		std::vector<uint8_t> fill(kIoReadBytes, 1);
+		bool bWritten = true;
+		for (size_t written = 0; written < kIoFileBytes && bWritten; written += fill.size())
+			bWritten = write(writeFd, fill.data(), fill.size()) == static_cast<ssize_t>(fill.size());
+		fsync(writeFd);
+		const int bufferedFd = open(path, O_RDONLY);
+		const int directFd = open(path, O_RDONLY | O_DIRECT);
+		unlink(path);
+		close(writeFd);
+
+		ReadRing ring;
+		Templated::IoBufferAllocator ioAllocator(1024 * 1024 * 16, 1);
+		if (!bWritten || bufferedFd < 0 || !ring.Init(8) || ioAllocator.RegionCount() == 0 || !ring.RegisterBuffers(ioAllocator.Regions(), static_cast<unsigned>(ioAllocator.RegionCount())))
+		{
+			output << "IoBufferReads: io_uring or the test file isn't available here\n";
+			if (bufferedFd >= 0)
+				close(bufferedFd);
+			if (directFd >= 0)
+				close(directFd);
+			return;
+		}
+
+		Templated::MemoryAllocator<Templated::IoBufferAllocator> allocator(ioAllocator, Templated::SizeClassTable(Templated::IoBufferAllocator::kPoolSizes));
+		auto acquireMalloc = [](int& /*bufferIdx*/) { return malloc(kIoReadBytes); };
+		auto releaseMalloc = [](void* pBuffer) { free(pBuffer); };
+		auto acquirePooled = [&](int& bufferIdx)
+		{
+			void* pBuffer = allocator.AllocateRaw(kIoReadBytes, Templated::IoBufferAllocator::Type::Other);
+			bufferIdx = ioAllocator.RegionIndex(pBuffer);
+			return pBuffer;
+		};
+		auto releasePooled = [&](void* pBuffer) { allocator.Free(pBuffer, kIoReadBytes); };
+
+		TimeReads(ring, bufferedFd, acquireMalloc, releaseMalloc);
+		const double mallocRead = TimeReads(ring, bufferedFd, acquireMalloc, releaseMalloc);
+		const double pooledRead = TimeReads(ring, bufferedFd, acquirePooled, releasePooled);
+		const double pooledDirect = directFd >= 0 ? TimeReads(ring, directFd, acquirePooled, releasePooled) : -1.0;
+
+		output << "IoBufferReads: " << kIoReads << " random 64kb reads through io_uring, a fresh buffer each\n";
+		output << "  malloc, READ                " << mallocRead << " ns/read\n";
+		output << "  pooled, READ_FIXED          " << pooledRead << " ns/read\n";
+		if (pooledDirect >= 0.0)
+			output << "  pooled, READ_FIXED O_DIRECT " << pooledDirect << " ns/read\n";
+		else
+			output << "  (O_DIRECT not supported by this file system)\n";
+
+		close(bufferedFd);
+		if (directFd >= 0)
+			close(directFd);
+#else
+		output << "IoBufferReads: built without io_uring support\n";
+#endif
+	}
+
+	void Run(std::ostream& output, const char* name)
+	{
+		struct Entry
+		{
+			const char* m_name;
+			void(*m_function)(std::ostream&);
+		};
+		static const Entry kBenchmarks[] =
+		{
+			{ "coloring", CacheColoring },
+			{ "thrash", CacheThrash },
+			{ "coroutine", CoroutineSpawn },
+			{ "io", IoBufferReads },
+		};
+
+		for (const Entry& entry : kBenchmarks)
+		{
+			if (name == nullptr || strcmp(name, entry.m_name) == 0)
+				entry.m_function(output);
+		}
+	}
+}
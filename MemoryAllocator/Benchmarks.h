@@ -0,0 +1,34 @@
+#pragma once
+#include <ostream>
+
+//Coroutine benchmarks need a C++20 toolchain
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define BENCHMARKS_COROUTINES 1
+#endif
+#endif
+
+//The file I/O benchmark drives io_uring directly and only builds on Linux
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define BENCHMARKS_IO_URING 1
+#endif
+#endif
+
+namespace Benchmarks
+{
+	//Walks the first block of many small-class pools, with and without slab colouring
+	void CacheColoring(std::ostream& output);
+
+	//Threads hammer their own 96 byte block, shared pools against thread owned cache line padded slabs
+	void CacheThrash(std::ostream& output);
+
+	//Spawns and destroys short coroutines, frames from the global operator new against CoroutineFrameAllocator
+	void CoroutineSpawn(std::ostream& output);
+
+	//Random file reads through io_uring into fresh malloc buffers against registered IoBufferAllocator blocks read with READ_FIXED
+	void IoBufferReads(std::ostream& output);
+
+	//Runs every benchmark, or only the one named
+	void Run(std::ostream& output, const char* name = nullptr);
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include "MemoryAllocator.h"
+#include <atomic>
+#include <mutex>
+#include <new>
+
+namespace Templated
+{
+	//Routes coroutine frames to a MemoryAllocator's size classes. Freed frames are cached per thread in kBucketGranularity buckets,
+	//so spawning and finishing coroutines of the same shape usually touches neither the allocator lock nor the size class lookup.
+	//Frames too big to cache go through the raw API and come back through the sized Free.
+	//Install the allocator once, before the first frame, and keep it alive until every thread has exited. Frames are never mixed: once
+	//a frame has come from the global operator new the allocator can't be installed, so every frame goes back where it came from.
+	template<typename T_ALLOCATOR>
+	class CoroutineFrameAllocator
+	{
+		static_assert(std::is_pointer<typename T_ALLOCATOR::Memory>::value, "Coroutine frames need an allocator handing out pointers");
+	public:
+		static constexpr size_t kBucketGranularity = 64;
+		static constexpr size_t kBucketCount = 32;				//Frames up to 2kb are cached
+		static constexpr size_t kMaxCachedPerBucket = 256;
+
+		//Returns false when an allocator is already installed or a frame was already allocated without one, frames then keep coming
+		//from wherever they came from before
+		static bool Install(MemoryAllocator<T_ALLOCATOR>* allocator)
+		{
+			if (!allocator)
+				return false;
+			std::lock_guard<std::mutex> lock(s_installMutex);
+			if (s_bGlobalFrames.load(std::memory_order_relaxed) || s_allocator.load(std::memory_order_relaxed))
+				return false;
+			s_allocator.store(allocator, std::memory_order_release);
+			return true;
+		}
+
+		static void* Allocate(size_t frameSize)
+		{
+			MemoryAllocator<T_ALLOCATOR>* allocator = s_allocator.load(std::memory_order_acquire);
+			if (!allocator && !(allocator = UseGlobalFrames()))
+				return ::operator new(frameSize);
+
+			const size_t bucketIdx = BucketIndex(frameSize);
+			if (bucketIdx < kBucketCount)
+			{
+				ThreadCache& cache = GetThreadCache();
+				if (CachedFrame* pFrame = cache.m_buckets[bucketIdx])
+				{
+					cache.m_buckets[bucketIdx] = pFrame->m_pNext;
+					cache.m_counts[bucketIdx]--;
+					return pFrame;
+				}
+				frameSize = (bucketIdx + 1) * kBucketGranularity;
+			}
+
+			void* pFrame = allocator->AllocateRaw(frameSize, T_ALLOCATOR::Type::Class);
+			if (pFrame == nullptr)
+				throw std::bad_alloc();
+			return pFrame;
+		}
+
+		//frameSize must be the size the frame was allocated with, as sized delete passes it
+		static void Deallocate(void* pFrame, size_t frameSize)
+		{
+			//With no allocator installed every frame came from the global operator new, with one every frame came from it
+			MemoryAllocator<T_ALLOCATOR>* allocator = s_allocator.load(std::memory_order_acquire);
+			if (!allocator)
+			{
+				::operator delete(pFrame);
+				return;
+			}
+
+			const size_t bucketIdx = BucketIndex(frameSize);
+			if (bucketIdx < kBucketCount)
+			{
+				ThreadCache& cache = GetThreadCache();
+				if (cache.m_counts[bucketIdx] < kMaxCachedPerBucket)
+				{
+					cache.m_buckets[bucketIdx] = new (pFrame) CachedFrame{ cache.m_buckets[bucketIdx] };
+					cache.m_counts[bucketIdx]++;
+					return;
+				}
+				frameSize = (bucketIdx + 1) * kBucketGranularity;
+			}
+			allocator->Free(pFrame, frameSize);
+		}
+
+		//Returns this thread's cached frames to the allocator, also done when the thread exits
+		static void FlushThreadCache()
+		{
+			GetThreadCache().Flush();
+		}
+
+	private:
+		struct CachedFrame
+		{
+			CachedFrame* m_pNext;
+		};
+
+		struct ThreadCache
+		{
+			~ThreadCache() { Flush(); }
+
+			void Flush()
+			{
+				MemoryAllocator<T_ALLOCATOR>* allocator = s_allocator.load(std::memory_order_acquire);
+				for (size_t bucketIdx = 0; bucketIdx < kBucketCount; bucketIdx++)
+				{
+					while (CachedFrame* pFrame = m_buckets[bucketIdx])
+					{
+						m_buckets[bucketIdx] = pFrame->m_pNext;
+						if (allocator)
+							allocator->Free(pFrame, (bucketIdx + 1) * kBucketGranularity);
+					}
+					m_counts[bucketIdx] = 0;
+				}
+			}
+
+			std::array<CachedFrame*, kBucketCount> m_buckets = {};
+			std::array<size_t, kBucketCount> m_counts = {};
+		};
+
+		static inline size_t BucketIndex(size_t frameSize) { return frameSize == 0 ? 0 : (frameSize - 1) / kBucketGranularity; }
+
+		//Called by the first frame allocated with no allocator installed. Returns an allocator installed in the meantime, otherwise
+		//locks Install out for good.
+		static MemoryAllocator<T_ALLOCATOR>* UseGlobalFrames()
+		{
+			if (s_bGlobalFrames.load(std::memory_order_acquire))
+				return nullptr;
+			std::lock_guard<std::mutex> lock(s_installMutex);
+			MemoryAllocator<T_ALLOCATOR>* allocator = s_allocator.load(std::memory_order_acquire);
+			if (!allocator)
+				s_bGlobalFrames.store(true, std::memory_order_release);
+			return allocator;
+		}
+
+		static ThreadCache& GetThreadCache()
+		{
+			thread_local ThreadCache t_cache;
+			return t_cache;
+		}
+
+		static inline std::atomic<MemoryAllocator<T_ALLOCATOR>*> s_allocator{ nullptr };
+		static inline std::atomic<bool> s_bGlobalFrames{ false };
+		static inline std::mutex s_installMutex;
+	};
+
+	//Promise type mixin, inherit from it in a coroutine's promise_type to take its frame from CoroutineFrameAllocator.
+	//Only the sized operator delete is declared so the compiler always hands back the frame size.
+	template<typename T_ALLOCATOR>
+	struct PooledCoroutineFrame
+	{
+		static void* operator new(size_t frameSize) { return CoroutineFrameAllocator<T_ALLOCATOR>::Allocate(frameSize); }
+		static void operator delete(void* pFrame, size_t frameSize) { CoroutineFrameAllocator<T_ALLOCATOR>::Deallocate(pFrame, frameSize); }
+	};
+}
@@ -0,0 +1,254 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Templated
+{
+	//Epoch based deferred reclamation. Readers bracket access with Enter()/the returned Guard, writers Retire() items they have unlinked.
+	//A retired item is only destroyed once every reader that could have seen it has left its epoch.
+	//Each thread claims one slot per reclaimer on first Enter and gives it back when the thread exits.
+	template<typename T_RETIRED>
+	class EpochReclaimer
+	{
+	public:
+		static constexpr uint64_t kInactive = ~0ull;
+		static constexpr size_t kDefaultThreadSlots = 256;
+		static constexpr size_t kDefaultBatchSize = 64;
+
+		class Guard
+		{
+		public:
+			Guard() = default;
+			Guard(Guard&& other) noexcept : m_reclaimer(other.m_reclaimer) { other.m_reclaimer = nullptr; }
+			Guard& operator=(Guard&& other) noexcept
+			{
+				if (this != &other)
+				{
+					Exit();
+					m_reclaimer = other.m_reclaimer;
+					other.m_reclaimer = nullptr;
+				}
+				return *this;
+			}
+			Guard(const Guard&) = delete;
+			Guard& operator=(const Guard&) = delete;
+			~Guard() { Exit(); }
+
+			inline void Exit()
+			{
+				if (m_reclaimer)
+					m_reclaimer->ExitEpoch();
+				m_reclaimer = nullptr;
+			}
+
+		private:
+			friend class EpochReclaimer;
+			explicit Guard(EpochReclaimer* reclaimer) : m_reclaimer(reclaimer) { }
+			EpochReclaimer* m_reclaimer = nullptr;
+		};
+
+		explicit EpochReclaimer(size_t threadSlotCount = kDefaultThreadSlots) : m_slots(std::make_shared<SlotArray>(threadSlotCount)), m_instanceId(NextInstanceId())
+		{
+
+		}
+		~EpochReclaimer() { ReclaimAll(); }
+		EpochReclaimer(const EpochReclaimer&) = delete;
+		EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+		//Reentrant, only the outermost guard on a thread publishes an epoch
+		Guard Enter()
+		{
+			ThreadEntry& entry = GetThreadEntry();
+			if (entry.m_depth++ == 0)
+			{
+				if (entry.m_slotIdx == kNoSlot)
+				{
+					m_overflowReaders.fetch_add(1, std::memory_order_seq_cst);
+				}
+				else
+				{
+					//Re-check the global epoch so a reclaim that scanned before our store can't miss us
+					std::atomic<uint64_t>& slotEpoch = m_slots->m_slots[entry.m_slotIdx].m_epoch;
+					uint64_t epoch = m_globalEpoch.load(std::memory_order_seq_cst);
+					for (;;)
+					{
+						slotEpoch.store(epoch, std::memory_order_seq_cst);
+						const uint64_t currentEpoch = m_globalEpoch.load(std::memory_order_seq_cst);
+						if (currentEpoch == epoch)
+							break;
+						epoch = currentEpoch;
+					}
+				}
+			}
+			return Guard(this);
+		}
+
+		//Destroys item once all current readers have exited, reclaiming in batches of m_batchSize
+		void Retire(T_RETIRED item)
+		{
+			bool bShouldReclaim = false;
+			{
+				std::lock_guard<std::mutex> lock(m_retiredMutex);
+				m_retired.emplace_back(m_globalEpoch.load(std::memory_order_seq_cst), std::move(item));
+				bShouldReclaim = m_retired.size() >= m_batchSize;
+			}
+			if (bShouldReclaim)
+				TryReclaim();
+		}
+
+		//Returns the number of items destroyed
+		size_t TryReclaim()
+		{
+			std::vector<T_RETIRED> reclaimable;
+			{
+				std::lock_guard<std::mutex> lock(m_retiredMutex);
+				m_globalEpoch.fetch_add(1, std::memory_order_seq_cst);
+				if (m_overflowReaders.load(std::memory_order_seq_cst) != 0)
+					return 0;
+
+				const uint64_t oldestActiveEpoch = OldestActiveEpoch();
+				size_t kept = 0;
+				for (size_t i = 0; i < m_retired.size(); i++)
+				{
+					if (m_retired[i].first < oldestActiveEpoch)
+						reclaimable.push_back(std::move(m_retired[i].second));
+					else if (kept++ != i)
+						m_retired[kept - 1] = std::move(m_retired[i]);
+				}
+				m_retired.erase(m_retired.begin() + kept, m_retired.end());
+			}
+			//Destroyed outside the lock, item destructors may take other locks
+			const size_t reclaimedCount = reclaimable.size();
+			reclaimable.clear();
+			return reclaimedCount;
+		}
+
+		//Destroys everything retired regardless of readers, only safe once no readers remain
+		void ReclaimAll()
+		{
+			std::vector<std::pair<uint64_t, T_RETIRED>> retired;
+			{
+				std::lock_guard<std::mutex> lock(m_retiredMutex);
+				retired.swap(m_retired);
+			}
+		}
+
+		void SetBatchSize(size_t batchSize)
+		{
+			std::lock_guard<std::mutex> lock(m_retiredMutex);
+			m_batchSize = batchSize ? batchSize : 1;
+		}
+
+		size_t RetiredCount() const
+		{
+			std::lock_guard<std::mutex> lock(m_retiredMutex);
+			return m_retired.size();
+		}
+
+	private:
+		static constexpr uint32_t kNoSlot = ~0u;
+
+		struct alignas(64) ThreadSlot
+		{
+			std::atomic<uint64_t> m_epoch{ kInactive };
+			std::atomic<bool> m_bClaimed{ false };
+		};
+
+		//Shared with the per thread entries so a thread exiting after the reclaimer is destroyed doesn't touch freed memory
+		struct SlotArray
+		{
+			explicit SlotArray(size_t slotCount) : m_slots(std::make_unique<ThreadSlot[]>(slotCount)), m_slotCount(slotCount) { }
+			std::unique_ptr<ThreadSlot[]> m_slots;
+			size_t m_slotCount;
+		};
+
+		struct ThreadEntry
+		{
+			std::weak_ptr<SlotArray> m_slots;
+			uint32_t m_slotIdx = kNoSlot;
+			uint32_t m_depth = 0;
+		};
+
+		struct ThreadEntries
+		{
+			~ThreadEntries()
+			{
+				for (auto& entry : m_entries)
+				{
+					if (entry.second.m_slotIdx == kNoSlot)
+						continue;
+					if (auto slots = entry.second.m_slots.lock())
+					{
+						slots->m_slots[entry.second.m_slotIdx].m_epoch.store(kInactive, std::memory_order_release);
+						slots->m_slots[entry.second.m_slotIdx].m_bClaimed.store(false, std::memory_order_release);
+					}
+				}
+			}
+			std::unordered_map<uint64_t, ThreadEntry> m_entries;
+		};
+
+		static uint64_t NextInstanceId()
+		{
+			static std::atomic<uint64_t> s_nextInstanceId{ 1 };
+			return s_nextInstanceId.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		ThreadEntry& GetThreadEntry()
+		{
+			thread_local ThreadEntries t_entries;
+			auto inserted = t_entries.m_entries.try_emplace(m_instanceId);
+			ThreadEntry& entry = inserted.first->second;
+			if (inserted.second)
+			{
+				entry.m_slots = m_slots;
+				for (size_t i = 0; i < m_slots->m_slotCount; i++)
+				{
+					bool bExpected = false;
+					if (m_slots->m_slots[i].m_bClaimed.compare_exchange_strong(bExpected, true, std::memory_order_acq_rel))
+					{
+						entry.m_slotIdx = static_cast<uint32_t>(i);
+						break;
+					}
+				}
+			}
+			return entry;
+		}
+
+		void ExitEpoch()
+		{
+			ThreadEntry& entry = GetThreadEntry();
+			if (--entry.m_depth != 0)
+				return;
+			if (entry.m_slotIdx == kNoSlot)
+				m_overflowReaders.fetch_sub(1, std::memory_order_release);
+			else
+				m_slots->m_slots[entry.m_slotIdx].m_epoch.store(kInactive, std::memory_order_release);
+		}
+
+		uint64_t OldestActiveEpoch() const
+		{
+			uint64_t oldestEpoch = kInactive;
+			for (size_t i = 0; i < m_slots->m_slotCount; i++)
+			{
+				const uint64_t epoch = m_slots->m_slots[i].m_epoch.load(std::memory_order_seq_cst);
+				if (epoch < oldestEpoch)
+					oldestEpoch = epoch;
+			}
+			return oldestEpoch;
+		}
+
+		std::shared_ptr<SlotArray> m_slots;
+		const uint64_t m_instanceId;
+		std::atomic<uint64_t> m_globalEpoch{ 0 };
+		std::atomic<uint32_t> m_overflowReaders{ 0 };	//Threads that found no free slot, they hold back all reclamation while inside
+
+		mutable std::mutex m_retiredMutex;
+		std::vector<std::pair<uint64_t, T_RETIRED>> m_retired;
+		size_t m_batchSize = kDefaultBatchSize;
+	};
+}
@@ -0,0 +1,529 @@
+#pragma once
+#include "MemoryAllocator.h"
+#include "RangeTable.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Templated
+{
+	//Platform allocator placing pools in a memory mapped file so a restarted process can reattach its previous heap.
+	//Memory is a byte offset into the file. Checkpoint() stores the pools, their free lists and block types, the file's own range table
+	//and a small set of roots in one of two metadata slots, alternating so a crash mid checkpoint leaves the previous one intact.
+	//Open() validates the header and picks the newest slot whose checksum and contents check out, then ranges no record accounts for are freed.
+	//
+	//	FileBackedAllocator file;
+	//	file.Open("cache.heap", fileSize);
+	//	MemoryAllocator<FileBackedAllocator> heap(file, sizeClasses);
+	//	heap.ImportPools(file.RestoredHeap());
+	//	auto cache = file.GetRoot(0);
+	//	...
+	//	file.Checkpoint(heap);
+	struct FileBackedAllocator : public CPPAllocator
+	{
+	public:
+		using Memory = uint64_t;
+		static constexpr Memory kMemoryDefault = ~Memory(0);
+		static constexpr uint32_t kMaxRoots = 64;
+		static constexpr Size kDefaultMetadataSlotBytes = 1024 * 1024 * 16;
+
+		enum class OpenResult
+		{
+			Created,			//New file, nothing to restore
+			Restored,			//RestoredHeap holds the last checkpoint
+			NoCheckpoint,		//Existing file that was never checkpointed
+			Failed				//Couldn't create or map the file, or its header doesn't match this version
+		};
+
+		struct Root
+		{
+			Memory m_memory = kMemoryDefault;
+			uint64_t m_size = 0;
+		};
+
+		FileBackedAllocator() = default;
+		~FileBackedAllocator() { Close(); }
+		FileBackedAllocator(const FileBackedAllocator&) = delete;
+		FileBackedAllocator& operator=(const FileBackedAllocator&) = delete;
+
+		//fileSize and metadataSlotBytes only apply when the file is created
+		OpenResult Open(const char* path, Size fileSize, Size metadataSlotBytes = kDefaultMetadataSlotBytes)
+		{
+			if (m_pBase)
+				return OpenResult::Failed;
+			metadataSlotBytes = AlignUp(metadataSlotBytes, kHeaderBytes);
+			bool bCreated = false;
+			if (!MapFile(path, fileSize, kHeaderBytes + 2 * metadataSlotBytes, bCreated))
+				return OpenResult::Failed;
+
+			FileHeader& header = Header();
+			if (bCreated)
+			{
+				header.m_version = kVersion;
+				header.m_fileBytes = m_fileBytes;
+				header.m_slotBytes = metadataSlotBytes;
+				header.m_dataBegin = kHeaderBytes + 2 * metadataSlotBytes;
+				header.m_magic = kMagic;
+				Flush(0, kHeaderBytes);
+			}
+			else if (header.m_magic != kMagic || header.m_version != kVersion || header.m_fileBytes != m_fileBytes || header.m_dataBegin != kHeaderBytes + 2 * header.m_slotBytes || header.m_dataBegin >= m_fileBytes)
+			{
+				Close();
+				return OpenResult::Failed;
+			}
+
+			m_ranges.Reset(header.m_dataBegin, m_fileBytes);
+			if (bCreated)
+				return OpenResult::Created;
+
+			//Newest valid slot first, an interrupted checkpoint fails its checksum and the older one is used
+			const uint64_t sequence0 = Slot(0).m_sequence;
+			const uint64_t sequence1 = Slot(1).m_sequence;
+			const uint32_t newestSlot = sequence1 > sequence0 ? 1 : 0;
+			for (uint32_t slotIdx : { newestSlot, 1 - newestSlot })
+			{
+				if (Slot(slotIdx).m_sequence != 0 && LoadSlot(slotIdx))
+				{
+					m_sequence = Slot(slotIdx).m_sequence;
+					return OpenResult::Restored;
+				}
+			}
+			if (sequence0 != 0 || sequence1 != 0)
+			{
+				Close();
+				return OpenResult::Failed;
+			}
+			return OpenResult::NoCheckpoint;
+		}
+
+		//Unmaps without checkpointing, every MemoryAllocator using the file must be destroyed first
+		void Close()
+		{
+			if (!m_pBase)
+				return;
+#if defined(_WIN32)
+			UnmapViewOfFile(m_pBase);
+			CloseHandle(m_mapping);
+			CloseHandle(m_file);
+			m_mapping = nullptr;
+			m_file = INVALID_HANDLE_VALUE;
+#else
+			munmap(m_pBase, m_fileBytes);
+			close(m_fd);
+			m_fd = -1;
+#endif
+			m_pBase = nullptr;
+			m_fileBytes = 0;
+			m_ranges.Reset(0, 0);
+			m_roots = {};
+			m_restoredHeap = {};
+		}
+
+		//Pools and large allocations from the checkpoint Open restored, pass to MemoryAllocator::ImportPools
+		inline const PersistedHeap<Memory>& RestoredHeap() const { return m_restoredHeap; }
+
+		//Roots are how a restarted process finds its data again, they are saved with the next checkpoint
+		void SetRoot(uint32_t rootIdx, Memory memory, Size memorySize)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (rootIdx < kMaxRoots)
+				m_roots[rootIdx] = { memory, memorySize };
+		}
+		Root GetRoot(uint32_t rootIdx) const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return rootIdx < kMaxRoots ? m_roots[rootIdx] : Root();
+		}
+
+		//Flushes the data region and then writes heap's pools with this allocator's ranges and roots to the older metadata slot.
+		//Returns false when the metadata doesn't fit in a slot, the previous checkpoint stays current.
+		template<typename T_HEAP>
+		bool Checkpoint(T_HEAP& heap)
+		{
+			std::lock_guard<std::mutex> checkpointLock(m_checkpointMutex);
+			if (!m_pBase)
+				return false;
+
+			PersistedHeap<Memory> persisted;
+			std::vector<char> payload;
+			heap.ExportPools(persisted, [&]()
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				WritePayload(payload, persisted);
+			});
+
+			FileHeader& header = Header();
+			if (sizeof(SlotHeader) + payload.size() > header.m_slotBytes)
+				return false;
+
+			//Block contents must be on disk before metadata claiming they are live
+			Flush(header.m_dataBegin, m_fileBytes - header.m_dataBegin);
+
+			const uint32_t slotIdx = static_cast<uint32_t>((m_sequence + 1) % 2);
+			SlotHeader& slot = Slot(slotIdx);
+			slot.m_sequence = 0;
+			Flush(SlotOffset(slotIdx), sizeof(SlotHeader));
+			memcpy(reinterpret_cast<char*>(&slot) + sizeof(SlotHeader), payload.data(), payload.size());
+			slot.m_payloadBytes = payload.size();
+			slot.m_checksum = Checksum(m_sequence + 1, payload.data(), payload.size());
+			Flush(SlotOffset(slotIdx) + sizeof(SlotHeader), payload.size());
+			slot.m_sequence = ++m_sequence;
+			Flush(SlotOffset(slotIdx), sizeof(SlotHeader));
+			return true;
+		}
+
+		inline void* Pointer(Memory memory) const { return memory == kMemoryDefault ? nullptr : m_pBase + memory; }
+		inline Memory ToMemory(const void* pMemory) const { return pMemory == nullptr ? kMemoryDefault : static_cast<Memory>(static_cast<const char*>(pMemory) - m_pBase); }
+		inline Size FileSize() const { return m_fileBytes; }
+
+		//T_ALLOCATOR interface. Ranges are rounded up to kAlignment and taken first fit from freed ranges before growing into the untouched end.
+		Memory Allocate(Size memorySize, Size memoryAlignment)
+		{
+			if (!m_pBase)
+				return kMemoryDefault;
+			memorySize = AlignUp(memorySize, kAlignment);
+			memoryAlignment = (std::max)(memoryAlignment, kAlignment);
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const uint64_t begin = m_ranges.Allocate(memorySize, memoryAlignment);
+			return begin == RangeTable::kNoRange ? kMemoryDefault : begin;
+		}
+		inline Memory Offset(Memory memoryIn, Size blockSize)
+		{
+			return memoryIn + blockSize;
+		}
+		inline Size Distance(Memory memoryBase, Memory memoryIn)
+		{
+			return static_cast<Size>(memoryIn - memoryBase);
+		}
+		void Free(Memory memory, Size memorySize)
+		{
+			if (memory == kMemoryDefault)
+				return;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_ranges.Free(memory, memory + AlignUp(memorySize, kAlignment));
+		}
+		inline void Copy(Memory destination, Memory source, Size memorySize)
+		{
+			memcpy(Pointer(destination), Pointer(source), memorySize);
+		}
+		inline void Zero(Memory destination, Size memorySize)
+		{
+			memset(Pointer(destination), 0, memorySize);
+		}
+
+	private:
+		static constexpr uint64_t kMagic = 0x50414548444C4946ull;
+		static constexpr uint64_t kVersion = 1;
+		static constexpr Size kHeaderBytes = 4096;
+
+		struct FileHeader
+		{
+			uint64_t m_magic;
+			uint64_t m_version;
+			uint64_t m_fileBytes;
+			uint64_t m_slotBytes;
+			uint64_t m_dataBegin;
+		};
+
+		//Followed by m_payloadBytes of payload, m_checksum covers m_sequence and the payload
+		struct SlotHeader
+		{
+			uint64_t m_sequence;		//0 while being written
+			uint64_t m_payloadBytes;
+			uint64_t m_checksum;
+		};
+
+		static inline uint64_t AlignUp(uint64_t value, uint64_t alignment) { return RangeTable::AlignUp(value, alignment); }
+
+		inline FileHeader& Header() const { return *reinterpret_cast<FileHeader*>(m_pBase); }
+		inline uint64_t SlotOffset(uint32_t slotIdx) const { return kHeaderBytes + slotIdx * Header().m_slotBytes; }
+		inline SlotHeader& Slot(uint32_t slotIdx) const { return *reinterpret_cast<SlotHeader*>(m_pBase + SlotOffset(slotIdx)); }
+
+		//FNV-1a
+		static uint64_t Checksum(uint64_t sequence, const char* pPayload, size_t payloadBytes)
+		{
+			uint64_t hash = 0xcbf29ce484222325ull;
+			auto mix = [&hash](const char* pBytes, size_t byteCount)
+			{
+				for (size_t i = 0; i < byteCount; i++)
+				{
+					hash ^= static_cast<uint8_t>(pBytes[i]);
+					hash *= 0x100000001b3ull;
+				}
+			};
+			mix(reinterpret_cast<const char*>(&sequence), sizeof(sequence));
+			mix(pPayload, payloadBytes);
+			return hash;
+		}
+
+		template<typename T>
+		static void Append(std::vector<char>& payload, const T& value)
+		{
+			const char* pBytes = reinterpret_cast<const char*>(&value);
+			payload.insert(payload.end(), pBytes, pBytes + sizeof(T));
+		}
+
+		void WritePayload(std::vector<char>& payload, const PersistedHeap<Memory>& heap) const
+		{
+			for (auto& root : m_roots)
+			{
+				Append(payload, root.m_memory);
+				Append(payload, root.m_size);
+			}
+			Append(payload, m_ranges.BumpOffset());
+			Append(payload, static_cast<uint64_t>(m_ranges.FreeRanges().size()));
+			for (auto& range : m_ranges.FreeRanges())
+			{
+				Append(payload, range.first);
+				Append(payload, range.second);
+			}
+			Append(payload, static_cast<uint64_t>(heap.m_largeAllocations.size()));
+			for (auto& large : heap.m_largeAllocations)
+			{
+				Append(payload, large.first);
+				Append(payload, large.second);
+			}
+			Append(payload, static_cast<uint64_t>(heap.m_pools.size()));
+			for (auto& pool : heap.m_pools)
+			{
+				Append(payload, pool.m_blockSize);
+				Append(payload, pool.m_blockStride);
+				Append(payload, pool.m_poolBytes);
+				Append(payload, pool.m_colorOffset);
+				Append(payload, pool.m_memory);
+				Append(payload, static_cast<uint64_t>(pool.m_types.size()));
+				Append(payload, static_cast<uint64_t>(pool.m_freeBlocks.size()));
+				for (auto type : pool.m_types)
+					Append(payload, type);
+				for (auto blockIdx : pool.m_freeBlocks)
+					Append(payload, blockIdx);
+			}
+		}
+
+		class PayloadReader
+		{
+		public:
+			PayloadReader(const char* pPayload, size_t payloadBytes) : m_pPayload(pPayload), m_payloadBytes(payloadBytes) { }
+
+			template<typename T>
+			bool Read(T& value)
+			{
+				if (m_payloadBytes - m_position < sizeof(T))
+					return false;
+				memcpy(&value, m_pPayload + m_position, sizeof(T));
+				m_position += sizeof(T);
+				return true;
+			}
+			inline bool HasRoomFor(uint64_t count, size_t elementBytes) const { return count <= RemainingBytes() / elementBytes; }
+			inline size_t RemainingBytes() const { return m_payloadBytes - m_position; }
+			inline bool AtEnd() const { return m_position == m_payloadBytes; }
+
+		private:
+			const char* m_pPayload;
+			size_t m_payloadBytes;
+			size_t m_position = 0;
+		};
+
+		//Parses and cross checks a slot. Every range must sit in the data region, free ranges and live records must not overlap,
+		//and whatever is allocated but not accounted for by a pool or large allocation is freed.
+		bool LoadSlot(uint32_t slotIdx)
+		{
+			const FileHeader& header = Header();
+			const SlotHeader& slot = Slot(slotIdx);
+			if (slot.m_payloadBytes > header.m_slotBytes - sizeof(SlotHeader))
+				return false;
+			const char* pPayload = reinterpret_cast<const char*>(&slot) + sizeof(SlotHeader);
+			if (Checksum(slot.m_sequence, pPayload, static_cast<size_t>(slot.m_payloadBytes)) != slot.m_checksum)
+				return false;
+
+			PayloadReader reader(pPayload, static_cast<size_t>(slot.m_payloadBytes));
+			std::array<Root, kMaxRoots> roots;
+			for (auto& root : roots)
+			{
+				if (!reader.Read(root.m_memory) || !reader.Read(root.m_size))
+					return false;
+			}
+
+			uint64_t bumpOffset = 0;
+			uint64_t count = 0;
+			if (!reader.Read(bumpOffset) || bumpOffset < header.m_dataBegin || bumpOffset > m_fileBytes)
+				return false;
+			auto inData = [&](uint64_t begin, uint64_t end) { return begin >= header.m_dataBegin && begin < end && end <= bumpOffset; };
+			//Size rounded up to kAlignment, checked before any add so corrupt values can't wrap
+			auto inDataSized = [&](uint64_t begin, uint64_t size) { return begin <= bumpOffset && size <= bumpOffset && inData(begin, begin + AlignUp(size, kAlignment)); };
+
+			//Every range the slot claims, tagged free or live, checked for overlaps once sorted
+			std::vector<std::pair<std::pair<uint64_t, uint64_t>, bool>> ranges;
+			if (!reader.Read(count) || !reader.HasRoomFor(count, 2 * sizeof(uint64_t)))
+				return false;
+			for (uint64_t i = 0; i < count; i++)
+			{
+				uint64_t begin = 0, end = 0;
+				if (!reader.Read(begin) || !reader.Read(end) || !inData(begin, end))
+					return false;
+				ranges.push_back({ { begin, end }, true });
+			}
+
+			PersistedHeap<Memory> heap;
+			if (!reader.Read(count) || !reader.HasRoomFor(count, 2 * sizeof(uint64_t)))
+				return false;
+			for (uint64_t i = 0; i < count; i++)
+			{
+				std::pair<Memory, uint64_t> large;
+				if (!reader.Read(large.first) || !reader.Read(large.second) || !inDataSized(large.first, large.second))
+					return false;
+				ranges.push_back({ { large.first, large.first + AlignUp(large.second, kAlignment) }, false });
+				heap.m_largeAllocations.push_back(large);
+			}
+
+			if (!reader.Read(count) || !reader.HasRoomFor(count, 7 * sizeof(uint64_t)))
+				return false;
+			for (uint64_t i = 0; i < count; i++)
+			{
+				PersistedPool<Memory> pool;
+				uint64_t blockCount = 0, freeCount = 0;
+				if (!reader.Read(pool.m_blockSize) || !reader.Read(pool.m_blockStride) || !reader.Read(pool.m_poolBytes) || !reader.Read(pool.m_colorOffset) ||
+					!reader.Read(pool.m_memory) || !reader.Read(blockCount) || !reader.Read(freeCount))
+					return false;
+				if (!inDataSized(pool.m_memory, pool.m_poolBytes) || !reader.HasRoomFor(blockCount, sizeof(uint32_t)))
+					return false;
+				if (!reader.HasRoomFor(freeCount, sizeof(uint32_t)) || freeCount > (reader.RemainingBytes() / sizeof(uint32_t)) - blockCount)
+					return false;
+				pool.m_types.resize(static_cast<size_t>(blockCount));
+				pool.m_freeBlocks.resize(static_cast<size_t>(freeCount));
+				for (auto& type : pool.m_types)
+					reader.Read(type);
+				for (auto& blockIdx : pool.m_freeBlocks)
+					reader.Read(blockIdx);
+				ranges.push_back({ { pool.m_memory, pool.m_memory + AlignUp(pool.m_poolBytes, kAlignment) }, false });
+				heap.m_pools.push_back(std::move(pool));
+			}
+			if (!reader.AtEnd())
+				return false;
+
+			std::sort(ranges.begin(), ranges.end());
+			for (size_t i = 1; i < ranges.size(); i++)
+			{
+				if (ranges[i].first.first < ranges[i - 1].first.second)
+					return false;
+			}
+
+			m_roots = roots;
+			m_restoredHeap = std::move(heap);
+			m_ranges.Reset(header.m_dataBegin, m_fileBytes);
+			m_ranges.SetBumpOffset(bumpOffset);
+			uint64_t accountedEnd = header.m_dataBegin;
+			for (auto& range : ranges)
+			{
+				if (range.first.first > accountedEnd)
+					m_ranges.Free(accountedEnd, range.first.first);
+				if (range.second)
+					m_ranges.Free(range.first.first, range.first.second);
+				accountedEnd = range.first.second;
+			}
+			if (bumpOffset > accountedEnd)
+				m_ranges.Free(accountedEnd, bumpOffset);
+			return true;
+		}
+
+		//minimumFileSize only applies to new files, an existing one just needs room for its header which Open then checks
+		bool MapFile(const char* path, Size fileSize, Size minimumFileSize, bool& bCreated)
+		{
+#if defined(_WIN32)
+			m_file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (m_file == INVALID_HANDLE_VALUE)
+				return false;
+			bCreated = GetLastError() != ERROR_ALREADY_EXISTS;
+			LARGE_INTEGER existingSize;
+			GetFileSizeEx(m_file, &existingSize);
+			if (existingSize.QuadPart == 0)
+				bCreated = true;
+			else
+				fileSize = static_cast<Size>(existingSize.QuadPart);
+			if (fileSize <= (bCreated ? minimumFileSize : kHeaderBytes))
+			{
+				CloseHandle(m_file);
+				m_file = INVALID_HANDLE_VALUE;
+				return false;
+			}
+			m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(uint64_t(fileSize) >> 32), static_cast<DWORD>(fileSize), nullptr);
+			void* pBase = m_mapping ? MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, fileSize) : nullptr;
+			if (pBase == nullptr)
+			{
+				if (m_mapping)
+					CloseHandle(m_mapping);
+				CloseHandle(m_file);
+				m_mapping = nullptr;
+				m_file = INVALID_HANDLE_VALUE;
+				return false;
+			}
+#else
+			const int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+			if (fd < 0)
+				return false;
+			struct stat fileStat;
+			if (fstat(fd, &fileStat) != 0)
+			{
+				close(fd);
+				return false;
+			}
+			bCreated = fileStat.st_size == 0;
+			if (!bCreated)
+				fileSize = static_cast<Size>(fileStat.st_size);
+			if (fileSize <= (bCreated ? minimumFileSize : kHeaderBytes) || (bCreated && ftruncate(fd, static_cast<off_t>(fileSize)) != 0))
+			{
+				close(fd);
+				return false;
+			}
+			void* pBase = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (pBase == MAP_FAILED)
+			{
+				close(fd);
+				return false;
+			}
+			m_fd = fd;
+#endif
+			m_pBase = static_cast<char*>(pBase);
+			m_fileBytes = fileSize;
+			return true;
+		}
+
+		void Flush(uint64_t offset, uint64_t byteCount)
+		{
+#if defined(_WIN32)
+			FlushViewOfFile(m_pBase + offset, static_cast<SIZE_T>(byteCount));
+			FlushFileBuffers(m_file);
+#else
+			const uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+			const uint64_t begin = offset & ~(pageSize - 1);
+			msync(m_pBase + begin, static_cast<size_t>(offset + byteCount - begin), MS_SYNC);
+#endif
+		}
+
+		char* m_pBase = nullptr;
+		Size m_fileBytes = 0;
+		uint64_t m_sequence = 0;
+		PersistedHeap<Memory> m_restoredHeap;
+		std::array<Root, kMaxRoots> m_roots = {};
+
+		mutable std::mutex m_mutex;			//Guards the range table and roots
+		std::mutex m_checkpointMutex;
+		RangeTable m_ranges;
+#if defined(_WIN32)
+		HANDLE m_file = INVALID_HANDLE_VALUE;
+		HANDLE m_mapping = nullptr;
+#else
+		int m_fd = -1;
+#endif
+	};
+}
@@ -0,0 +1,203 @@
+#include "HeapProfiler.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#elif defined(__has_include)
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define HEAP_PROFILER_EXECINFO 1
+#endif
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#define HEAP_PROFILER_DEMANGLE 1
+#endif
+#endif
+
+namespace Templated
+{
+	namespace
+	{
+		size_t CaptureStack(void** frames, size_t maxFrames, size_t skipFrames)
+		{
+#if defined(_WIN32)
+			return RtlCaptureStackBackTrace(static_cast<DWORD>(skipFrames + 1), static_cast<DWORD>(maxFrames), frames, nullptr);
+#elif defined(HEAP_PROFILER_EXECINFO)
+			void* allFrames[HeapProfiler::kMaxStackDepth + 8];
+			const int captured = backtrace(allFrames, static_cast<int>((std::min)(maxFrames + skipFrames + 1, sizeof(allFrames) / sizeof(allFrames[0]))));
+			const size_t first = (std::min)(skipFrames + 1, static_cast<size_t>(captured));
+			std::copy(allFrames + first, allFrames + captured, frames);
+			return static_cast<size_t>(captured) - first;
+#else
+			(void)frames;
+			(void)maxFrames;
+			(void)skipFrames;
+			return 0;
+#endif
+		}
+
+		std::string HexAddress(const void* frame)
+		{
+			std::ostringstream hex;
+			hex << "0x" << std::hex << reinterpret_cast<uintptr_t>(frame);
+			return hex.str();
+		}
+
+		//Function names where the platform can give them cheaply, otherwise the address. Names come from the dynamic symbol
+		//table on Linux so link with -rdynamic to see more than exported functions.
+		std::vector<std::string> SymbolizeStack(const std::vector<void*>& stack)
+		{
+			std::vector<std::string> names;
+			names.reserve(stack.size());
+#if defined(HEAP_PROFILER_EXECINFO)
+			char** symbols = backtrace_symbols(stack.data(), static_cast<int>(stack.size()));
+			for (size_t frameIdx = 0; frameIdx < stack.size(); frameIdx++)
+			{
+				//"module(symbol+0x1f) [0x...]"
+				std::string name;
+				const char* begin = symbols ? std::strchr(symbols[frameIdx], '(') : nullptr;
+				const char* end = begin ? std::strpbrk(begin, "+)") : nullptr;
+				if (begin && end && end > begin + 1)
+					name.assign(begin + 1, end);
+#if defined(HEAP_PROFILER_DEMANGLE)
+				if (!name.empty())
+				{
+					int status = 0;
+					char* demangled = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+					if (status == 0 && demangled)
+						name = demangled;
+					std::free(demangled);
+				}
+#endif
+				names.push_back(name.empty() ? HexAddress(stack[frameIdx]) : name);
+			}
+			std::free(symbols);
+#else
+			for (void* frame : stack)
+				names.push_back(HexAddress(frame));
+#endif
+			//Semicolons separate frames in the folded format
+			for (std::string& name : names)
+				std::replace(name.begin(), name.end(), ';', ':');
+			return names;
+		}
+	}
+
+	void HeapProfiler::Record(uint64_t address, size_t requestedBytes, size_t blockBytes, size_t skipFrames)
+	{
+		Sample sample;
+		sample.m_requestedBytes = requestedBytes;
+		sample.m_blockBytes = blockBytes;
+		sample.m_sampleIntervalBytes = m_sampleIntervalBytes.load(std::memory_order_acquire);
+		if (sample.m_sampleIntervalBytes == 0)
+			return;
+		void* frames[kMaxStackDepth];
+		sample.m_stack.assign(frames, frames + CaptureStack(frames, kMaxStackDepth, skipFrames + 1));
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_samples.insert_or_assign(address, std::move(sample)).second)
+			m_liveSampleCount.fetch_add(1, std::memory_order_release);
+	}
+
+	void HeapProfiler::Move(uint64_t fromAddress, uint64_t toAddress)
+	{
+		if (m_liveSampleCount.load(std::memory_order_acquire) == 0)
+			return;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto sample = m_samples.find(fromAddress);
+		if (sample == m_samples.end())
+			return;
+		Sample moved = std::move(sample->second);
+		m_samples.erase(sample);
+		m_samples.insert_or_assign(toAddress, std::move(moved));
+	}
+
+	int64_t HeapProfiler::NextSampleDistance(size_t sampleIntervalBytes)
+	{
+		thread_local std::minstd_rand t_random(std::random_device{}());
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		const double distance = -std::log(1.0 - uniform(t_random)) * static_cast<double>(sampleIntervalBytes);
+		return static_cast<int64_t>((std::min)(distance, static_cast<double>(INT64_MAX / 2)));
+	}
+
+	double HeapProfiler::SampleWeight(size_t blockBytes, size_t sampleIntervalBytes)
+	{
+		const double probability = 1.0 - std::exp(-static_cast<double>(blockBytes) / static_cast<double>(sampleIntervalBytes));
+		return probability > 0.0 ? 1.0 / probability : 1.0;
+	}
+
+	std::map<std::vector<void*>, HeapProfiler::StackTotals> HeapProfiler::TotalsByStack() const
+	{
+		std::map<std::vector<void*>, StackTotals> totals;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (const auto& [address, sample] : m_samples)
+		{
+			const double weight = SampleWeight(sample.m_blockBytes, sample.m_sampleIntervalBytes);
+			StackTotals& stackTotals = totals[sample.m_stack];
+			stackTotals.m_count += weight;
+			stackTotals.m_bytes += weight * static_cast<double>(sample.m_blockBytes);
+		}
+		return totals;
+	}
+
+	std::string HeapProfiler::FormatPprof() const
+	{
+		const auto totals = TotalsByStack();
+		uint64_t totalCount = 0;
+		uint64_t totalBytes = 0;
+		std::ostringstream body;
+		for (const auto& [stack, stackTotals] : totals)
+		{
+			const uint64_t count = static_cast<uint64_t>(std::llround(stackTotals.m_count));
+			const uint64_t bytes = static_cast<uint64_t>(std::llround(stackTotals.m_bytes));
+			totalCount += count;
+			totalBytes += bytes;
+			body << count << ": " << bytes << " [" << count << ": " << bytes << "] @";
+			for (void* frame : stack)
+				body << " " << HexAddress(frame);
+			body << "\n";
+		}
+
+		//Totals are already unsampled so the profile is written as unsampled
+		std::ostringstream profile;
+		profile << "heap profile: " << totalCount << ": " << totalBytes << " [" << totalCount << ": " << totalBytes << "] @ heap\n";
+		profile << body.str();
+#if defined(__linux__)
+		std::ifstream maps("/proc/self/maps");
+		if (maps)
+			profile << "\nMAPPED_LIBRARIES:\n" << maps.rdbuf();
+#endif
+		return profile.str();
+	}
+
+	std::string HeapProfiler::FormatFolded() const
+	{
+		const auto totals = TotalsByStack();
+		std::map<std::string, double> bytesByLine;
+		for (const auto& [stack, stackTotals] : totals)
+		{
+			const std::vector<std::string> names = SymbolizeStack(stack);
+			std::string line;
+			for (auto name = names.rbegin(); name != names.rend(); ++name)
+			{
+				if (!line.empty())
+					line += ';';
+				line += *name;
+			}
+			bytesByLine[line.empty() ? std::string("[unknown]") : line] += stackTotals.m_bytes;
+		}
+
+		std::ostringstream folded;
+		for (const auto& [line, bytes] : bytesByLine)
+			folded << line << " " << std::llround(bytes) << "\n";
+		return folded.str();
+	}
+}
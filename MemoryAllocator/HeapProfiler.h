@@ -0,0 +1,111 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Templated
+{
+	enum class HeapProfileFormat
+	{
+		Pprof,			//Legacy text heap profile with /proc/self/maps appended, readable by pprof
+		Folded			//One "root;...;leaf bytes" line per stack for flamegraph.pl
+	};
+
+	//Opt-in sampled heap profile, see MemoryAllocator::SetHeapProfilePolicy. On average one allocation in every m_sampleIntervalBytes
+	//of block bytes is sampled, the gaps drawn from an exponential distribution so allocations of every size get a fair chance.
+	struct HeapProfilePolicy
+	{
+		bool m_bEnabled = false;
+		size_t m_sampleIntervalBytes = 512 * 1024;
+	};
+
+	//Side table of sampled live allocations keyed by address, each with the call stack it was allocated from.
+	//The table has its own lock so stacks are captured without holding the allocator's. Both formats report estimated
+	//totals, each sample scaled by the inverse of the chance it had of being sampled.
+	class HeapProfiler
+	{
+	public:
+		static constexpr size_t kMaxStackDepth = 64;
+
+		void SetPolicy(const HeapProfilePolicy& policy)
+		{
+			m_sampleIntervalBytes.store(policy.m_bEnabled ? (std::max<size_t>)(policy.m_sampleIntervalBytes, 1) : 0, std::memory_order_release);
+		}
+
+		inline bool IsEnabled() const { return m_sampleIntervalBytes.load(std::memory_order_acquire) != 0; }
+
+		//Counts blockBytes against this thread's distance to the next sample, true when it is reached
+		inline bool ShouldSample(size_t blockBytes) const
+		{
+			const size_t sampleIntervalBytes = m_sampleIntervalBytes.load(std::memory_order_acquire);
+			if (sampleIntervalBytes == 0)
+				return false;
+			thread_local int64_t t_bytesUntilSample = -1;
+			if (t_bytesUntilSample < 0)
+				t_bytesUntilSample = NextSampleDistance(sampleIntervalBytes);
+			t_bytesUntilSample -= static_cast<int64_t>(blockBytes);
+			if (t_bytesUntilSample >= 0)
+				return false;
+			t_bytesUntilSample = NextSampleDistance(sampleIntervalBytes);
+			return true;
+		}
+
+		//Captures the caller's stack, skipping the frames inside the allocator
+		void Record(uint64_t address, size_t requestedBytes, size_t blockBytes, size_t skipFrames);
+
+		//Call before the block can be handed out again, cheap while nothing is sampled
+		inline void Forget(uint64_t address)
+		{
+			if (m_liveSampleCount.load(std::memory_order_acquire) == 0)
+				return;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_samples.erase(address))
+				m_liveSampleCount.fetch_sub(1, std::memory_order_release);
+		}
+
+		//Follows a block Compact moved
+		void Move(uint64_t fromAddress, uint64_t toAddress);
+
+		size_t LiveSampleCount() const { return m_liveSampleCount.load(std::memory_order_acquire); }
+
+		template<typename T>
+		void Write(T& output, HeapProfileFormat format) const
+		{
+			output << (format == HeapProfileFormat::Pprof ? FormatPprof() : FormatFolded());
+		}
+
+		std::string FormatPprof() const;
+		std::string FormatFolded() const;
+
+	private:
+		struct Sample
+		{
+			size_t m_requestedBytes = 0;
+			size_t m_blockBytes = 0;
+			size_t m_sampleIntervalBytes = 0;
+			std::vector<void*> m_stack;		//Innermost frame first
+		};
+
+		static int64_t NextSampleDistance(size_t sampleIntervalBytes);
+
+		//Allocations a sample stands for, one of blockBytes is sampled with probability 1 - e^(-blockBytes / interval)
+		static double SampleWeight(size_t blockBytes, size_t sampleIntervalBytes);
+
+		struct StackTotals
+		{
+			double m_count = 0.0;
+			double m_bytes = 0.0;
+		};
+		std::map<std::vector<void*>, StackTotals> TotalsByStack() const;
+
+		mutable std::mutex m_mutex;
+		std::unordered_map<uint64_t, Sample> m_samples;
+		std::atomic<size_t> m_liveSampleCount{ 0 };
+		std::atomic<size_t> m_sampleIntervalBytes{ 0 };			//0 while disabled
+	};
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include "PlatformAllocators.h"
+
+#if !defined(_WIN32)
+#include <sys/uio.h>
+#endif
+
+namespace Templated
+{
+#if defined(_WIN32)
+	//Same layout as the POSIX iovec
+	struct IoVector
+	{
+		void* iov_base;
+		size_t iov_len;
+	};
+#else
+	using IoVector = iovec;
+#endif
+
+	//Platform allocator for direct and registered I/O. A few large regions are mapped up front and never grow, every pool is carved from
+	//one of them on a page boundary and the size classes are page multiples, so every block is page aligned and page sized as O_DIRECT wants.
+	//Register Regions() once, eg with io_uring_register_buffers, and pass RegionIndex of a block as the buf_index of READ_FIXED/WRITE_FIXED.
+	//kAlignedBlocks makes MemoryAllocator keep to page multiple classes and refuse a ColoringPolicy, which would shift blocks off their page boundary.
+	struct IoBufferAllocator : public CPPAllocator
+	{
+	public:
+		static constexpr Size kPageSize = 4096;
+		static constexpr Size kMinAllocationSizeBytes = kPageSize;
+		static constexpr Size kAlignment = kPageSize;
+		static constexpr Size kMaxAllocationSize = 1024 * 1024 * 64;
+		static constexpr bool kAlignedBlocks = true;
+
+		static constexpr PoolSizeConstructor kPoolSizes[] =
+		{
+			//Size, Count
+			{4 * 1024,		256},
+			{8 * 1024,		128},
+			{16 * 1024,		64},
+			{32 * 1024,		32},
+			{64 * 1024,		32},
+			{128 * 1024,	16},
+			{256 * 1024,	8},
+			{512 * 1024,	4},
+			{1024 * 1024,	4},
+			{1024 * 1024 * 2,	2},
+			{1024 * 1024 * 4,	1},
+		};
+		static constexpr auto kArrayTotalSize = sizeof(kPoolSizes) / sizeof(kPoolSizes[0]);
+
+		static constexpr bool ArePageMultiples()
+		{
+			for (const PoolSizeConstructor& sizeClass : kPoolSizes)
+			{
+				if (sizeClass.kPoolSize % kPageSize != 0)
+					return false;
+			}
+			return true;
+		}
+
+		//Regions that fail to map are left out, check RegionCount
+		IoBufferAllocator(Size regionBytes = 1024 * 1024 * 64, Size regionCount = 1)
+		{
+			regionBytes = static_cast<Size>(RangeTable::AlignUp(regionBytes, kPageSize));
+			for (Size regionIdx = 0; regionIdx < regionCount; regionIdx++)
+			{
+				void* pRegion = m_pages.Allocate(regionBytes, kPageSize);
+				if (pRegion == MMapAllocator::kMemoryDefault)
+					continue;
+				m_regions.emplace_back();
+				m_regions.back().Reset(reinterpret_cast<uintptr_t>(pRegion), reinterpret_cast<uintptr_t>(pRegion) + regionBytes);
+				m_iovecs.push_back(IoVector{ pRegion, regionBytes });
+			}
+		}
+		~IoBufferAllocator()
+		{
+			for (const IoVector& region : m_iovecs)
+				m_pages.Free(region.iov_base, region.iov_len);
+		}
+		IoBufferAllocator(const IoBufferAllocator&) = delete;
+		IoBufferAllocator& operator=(const IoBufferAllocator&) = delete;
+
+		//Returns kMemoryDefault once no region has room, the regions never grow
+		Memory Allocate(Size memorySize, Size memoryAlignment)
+		{
+			const uint64_t rangeBytes = RangeTable::AlignUp(memorySize, kPageSize);
+			const uint64_t rangeAlignment = RangeTable::AlignUp((std::max)(memoryAlignment, kPageSize), kPageSize);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (RangeTable& region : m_regions)
+			{
+				const uint64_t begin = region.Allocate(rangeBytes, rangeAlignment);
+				if (begin != RangeTable::kNoRange)
+					return reinterpret_cast<Memory>(static_cast<uintptr_t>(begin));
+			}
+			return kMemoryDefault;
+		}
+		void Free(Memory pMemory, Size memorySize)
+		{
+			const int regionIdx = RegionIndex(pMemory);
+			if (regionIdx < 0)
+				return;
+			const uint64_t begin = reinterpret_cast<uintptr_t>(pMemory);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_regions[regionIdx].Free(begin, begin + RangeTable::AlignUp(memorySize, kPageSize));
+		}
+
+		//The fixed regions, in the order io_uring_register_buffers numbers them
+		inline const IoVector* Regions() const { return m_iovecs.data(); }
+		inline Size RegionCount() const { return m_iovecs.size(); }
+
+		//Region holding pMemory, the buf_index for fixed buffer I/O, or -1 when it isn't from this allocator
+		int RegionIndex(const void* pMemory) const
+		{
+			const uintptr_t address = reinterpret_cast<uintptr_t>(pMemory);
+			for (size_t regionIdx = 0; regionIdx < m_iovecs.size(); regionIdx++)
+			{
+				const uintptr_t regionBegin = reinterpret_cast<uintptr_t>(m_iovecs[regionIdx].iov_base);
+				if (address >= regionBegin && address < regionBegin + m_iovecs[regionIdx].iov_len)
+					return static_cast<int>(regionIdx);
+			}
+			return -1;
+		}
+
+	private:
+		MMapAllocator m_pages;
+		std::vector<RangeTable> m_regions;			//Absolute addresses, one table per region
+		std::vector<IoVector> m_iovecs;
+		std::mutex m_mutex;
+	};
+	static_assert(IoBufferAllocator::ArePageMultiples(), "IoBufferAllocator size classes must be whole pages");
+}
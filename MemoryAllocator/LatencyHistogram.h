@@ -0,0 +1,219 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+namespace Templated
+{
+	enum class LatencyEvent
+	{
+		Allocate,			//Whole allocation call, sampled
+		Free,				//Handle release and sized raw free, sampled
+		LockWait,			//Waiting for the allocator lock on the allocation path, sampled
+		AddPool,			//Creating a pool including its platform allocation, always timed
+		PlatformAllocate,	//T_ALLOCATOR::Allocate or Reserve for a pool or large allocation, always timed
+		PlatformFree		//T_ALLOCATOR::Free of a pool or large allocation, always timed
+	};
+	constexpr size_t kLatencyEventCount = 6;
+
+	//Opt-in latency recording, see MemoryAllocator::SetLatencyPolicy. Frequent events are timed on one call in m_sampleEvery per thread,
+	//rare expensive ones on every call so pool growth always shows up in the tail.
+	struct LatencyPolicy
+	{
+		bool m_bEnabled = false;
+		uint32_t m_sampleEvery = 64;
+	};
+
+	struct LatencySummary
+	{
+		uint64_t m_count = 0;
+		uint64_t m_p50Ns = 0;
+		uint64_t m_p99Ns = 0;
+		uint64_t m_p999Ns = 0;
+		uint64_t m_maxNs = 0;
+	};
+
+	//Log linear histogram of nanoseconds in the style of HdrHistogram. Values below kLinearLimit get a bucket each, above that every
+	//power of two is split into kSubBuckets so a percentile is reported within 1/kSubBuckets of the real value. Recording is lock free.
+	class LatencyHistogram
+	{
+	public:
+		static constexpr uint64_t kSubBucketBits = 3;
+		static constexpr uint64_t kSubBuckets = 1ull << kSubBucketBits;
+		static constexpr uint64_t kLinearLimit = kSubBuckets * 2;
+		static constexpr uint64_t kMaxExponent = 36;					//Anything longer than ~68 seconds lands in the last bucket
+		static constexpr size_t kBucketCount = static_cast<size_t>(kLinearLimit + (kMaxExponent - kSubBucketBits - 1) * kSubBuckets);
+
+		void Record(uint64_t valueNs)
+		{
+			m_buckets[BucketIndex(valueNs)].fetch_add(1, std::memory_order_relaxed);
+			uint64_t maxNs = m_maxNs.load(std::memory_order_relaxed);
+			while (valueNs > maxNs && !m_maxNs.compare_exchange_weak(maxNs, valueNs, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		//Percentiles are the upper bound of the bucket they fall in, capped at the largest value seen
+		LatencySummary Summarize() const
+		{
+			std::array<uint64_t, kBucketCount> counts;
+			LatencySummary summary;
+			for (size_t bucketIdx = 0; bucketIdx < kBucketCount; bucketIdx++)
+			{
+				counts[bucketIdx] = m_buckets[bucketIdx].load(std::memory_order_relaxed);
+				summary.m_count += counts[bucketIdx];
+			}
+			summary.m_maxNs = m_maxNs.load(std::memory_order_relaxed);
+			if (summary.m_count == 0)
+				return summary;
+
+			auto percentile = [&](uint64_t perThousand)
+			{
+				const uint64_t rank = (summary.m_count * perThousand + 999) / 1000;
+				uint64_t seen = 0;
+				for (size_t bucketIdx = 0; bucketIdx < kBucketCount; bucketIdx++)
+				{
+					seen += counts[bucketIdx];
+					if (seen >= rank)
+						return (std::min)(BucketUpperBound(bucketIdx), summary.m_maxNs);
+				}
+				return summary.m_maxNs;
+			};
+			summary.m_p50Ns = percentile(500);
+			summary.m_p99Ns = percentile(990);
+			summary.m_p999Ns = percentile(999);
+			return summary;
+		}
+
+		void Reset()
+		{
+			for (auto& bucket : m_buckets)
+				bucket.store(0, std::memory_order_relaxed);
+			m_maxNs.store(0, std::memory_order_relaxed);
+		}
+
+		static inline size_t BucketIndex(uint64_t valueNs)
+		{
+			if (valueNs < kLinearLimit)
+				return static_cast<size_t>(valueNs);
+			uint64_t exponent = 63;
+			while ((valueNs >> exponent) == 0)
+				exponent--;
+			if (exponent >= kMaxExponent)
+				return kBucketCount - 1;
+			const uint64_t subBucket = (valueNs >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+			return static_cast<size_t>(kLinearLimit + (exponent - kSubBucketBits - 1) * kSubBuckets + subBucket);
+		}
+
+		static inline uint64_t BucketUpperBound(size_t bucketIdx)
+		{
+			if (bucketIdx < kLinearLimit)
+				return bucketIdx;
+			const uint64_t exponent = (bucketIdx - kLinearLimit) / kSubBuckets + kSubBucketBits + 1;
+			const uint64_t subBucket = (bucketIdx - kLinearLimit) % kSubBuckets;
+			return (1ull << exponent) + ((subBucket + 1) << (exponent - kSubBucketBits)) - 1;
+		}
+
+	private:
+		std::array<std::atomic<uint64_t>, kBucketCount> m_buckets = {};
+		std::atomic<uint64_t> m_maxNs{ 0 };
+	};
+
+	//One histogram per event for each size class plus a last slot for allocations too large for any class.
+	//The histograms are allocated the first time recording is enabled and kept until the recorder is destroyed,
+	//so turning recording off and on again never races with a thread still recording.
+	class LatencyRecorder
+	{
+	public:
+		//Call with the owner's lock held
+		void SetPolicy(size_t classCount, const LatencyPolicy& policy)
+		{
+			if (policy.m_bEnabled && !m_histograms)
+			{
+				m_slotCount = classCount + 1;
+				m_histograms.reset(new LatencyHistogram[m_slotCount * kLatencyEventCount]);
+			}
+			m_sampleEvery.store(policy.m_bEnabled ? (std::max)(policy.m_sampleEvery, 1u) : 0, std::memory_order_release);
+		}
+
+		inline bool IsEnabled() const { return m_sampleEvery.load(std::memory_order_acquire) != 0; }
+
+		//True on one call in m_sampleEvery on each thread while enabled
+		inline bool ShouldSample() const
+		{
+			const uint32_t sampleEvery = m_sampleEvery.load(std::memory_order_acquire);
+			if (sampleEvery == 0)
+				return false;
+			thread_local uint32_t t_countdown = 0;
+			if (t_countdown == 0)
+			{
+				t_countdown = sampleEvery - 1;
+				return true;
+			}
+			t_countdown--;
+			return false;
+		}
+
+		static inline uint64_t NowNs()
+		{
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+		}
+
+		//Class indices past the last class are counted as large allocations
+		inline void Record(size_t classIdx, LatencyEvent event, uint64_t startNs)
+		{
+			const uint64_t endNs = NowNs();
+			Histogram(classIdx, event).Record(endNs > startNs ? endNs - startNs : 0);
+		}
+
+		LatencySummary Summarize(size_t classIdx, LatencyEvent event) const
+		{
+			if (!m_histograms)
+				return LatencySummary();
+			return Histogram(classIdx, event).Summarize();
+		}
+
+		void Reset()
+		{
+			for (size_t i = 0; m_histograms && i < m_slotCount * kLatencyEventCount; i++)
+				m_histograms[i].Reset();
+		}
+
+	private:
+		inline LatencyHistogram& Histogram(size_t classIdx, LatencyEvent event) const
+		{
+			const size_t slotIdx = (std::min)(classIdx, m_slotCount - 1);
+			return m_histograms[slotIdx * kLatencyEventCount + static_cast<size_t>(event)];
+		}
+
+		std::unique_ptr<LatencyHistogram[]> m_histograms;
+		size_t m_slotCount = 0;
+		std::atomic<uint32_t> m_sampleEvery{ 0 };
+	};
+
+	//Times its own lifetime into a LatencyRecorder when bActive
+	class LatencyScope
+	{
+	public:
+		LatencyScope(LatencyRecorder& recorder, size_t classIdx, LatencyEvent event, bool bActive) : m_recorder(bActive ? &recorder : nullptr), m_classIdx(classIdx), m_event(event), m_startNs(bActive ? LatencyRecorder::NowNs() : 0)
+		{
+
+		}
+		~LatencyScope()
+		{
+			if (m_recorder)
+				m_recorder->Record(m_classIdx, m_event, m_startNs);
+		}
+		LatencyScope(const LatencyScope&) = delete;
+		LatencyScope& operator=(const LatencyScope&) = delete;
+
+	private:
+		LatencyRecorder* m_recorder;
+		size_t m_classIdx;
+		LatencyEvent m_event;
+		uint64_t m_startNs;
+	};
+}
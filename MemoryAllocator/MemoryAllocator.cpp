@@ -1 +1,160 @@
-#include "MemoryAllocator.h"
\ No newline at end of file
+#include "MemoryAllocator.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cctype>
+
+namespace Templated
+{
+	namespace
+	{
+		std::optional<std::string> ReadEnvironmentVariable(const char* name)
+		{
+#ifdef _MSC_VER
+			char* value = nullptr;
+			size_t length = 0;
+			if (_dupenv_s(&value, &length, name) != 0 || value == nullptr)
+				return {};
+			std::string result(value);
+			free(value);
+			return result;
+#else
+			const char* value = std::getenv(name);
+			if (value == nullptr)
+				return {};
+			return std::string(value);
+#endif
+		}
+
+		bool IsSeparator(char c)
+		{
+			return std::isspace(static_cast<unsigned char>(c)) || c == ',' || c == ';' || c == ':' || c == 'x' || c == 'X';
+		}
+	}
+
+	SizeClassTable::SizeClassTable(std::vector<PoolSizeConstructor> sizeClasses) : m_classes(std::move(sizeClasses))
+	{
+		std::sort(m_classes.begin(), m_classes.end(), [](const PoolSizeConstructor& a, const PoolSizeConstructor& b) { return a.kPoolSize < b.kPoolSize; });
+		m_classes.erase(std::unique(m_classes.begin(), m_classes.end(), [](const PoolSizeConstructor& a, const PoolSizeConstructor& b) { return a.kPoolSize == b.kPoolSize; }), m_classes.end());
+		m_classes.erase(std::remove_if(m_classes.begin(), m_classes.end(), [](const PoolSizeConstructor& c) { return c.kPoolSize == 0 || c.kPoolCount == 0; }), m_classes.end());
+		if (m_classes.size() > kMaxClassCount)
+			m_classes.erase(m_classes.begin() + kMaxClassCount, m_classes.end());
+		if (m_classes.empty())
+			return;
+
+		m_maxBlockSize = m_classes.back().kPoolSize;
+
+		//Each entry holds the first class able to hold the smallest size mapping to that entry
+		auto buildLookup = [this](std::vector<uint8_t>& lookup, Size shift, Size limit)
+		{
+			lookup.resize(((limit - 1) >> shift) + 1);
+			Size classIdx = 0;
+			for (Size entry = 0; entry < lookup.size(); entry++)
+			{
+				const Size smallestSize = (entry << shift) + 1;
+				while (classIdx + 1 < m_classes.size() && m_classes[classIdx].kPoolSize < smallestSize)
+					classIdx++;
+				lookup[entry] = static_cast<uint8_t>(classIdx);
+			}
+		};
+		buildLookup(m_fineLookup, kFineGranularityShift, kFineLimit);
+		if (m_maxBlockSize > kFineLimit)
+			buildLookup(m_coarseLookup, kCoarseGranularityShift, m_maxBlockSize);
+	}
+
+	std::optional<SizeClassTable> SizeClassTable::FromString(const std::string& text, Size alignment)
+	{
+		constexpr Size kMaxValue = ~Size(0);
+		std::vector<Size> values;
+		size_t i = 0;
+		while (i < text.size())
+		{
+			const char c = text[i];
+			if (c == '#')
+			{
+				while (i < text.size() && text[i] != '\n')
+					i++;
+				continue;
+			}
+			if (IsSeparator(c))
+			{
+				i++;
+				continue;
+			}
+			if (!std::isdigit(static_cast<unsigned char>(c)))
+				return {};
+
+			Size value = 0;
+			while (i < text.size() && std::isdigit(static_cast<unsigned char>(text[i])))
+			{
+				const Size digit = static_cast<Size>(text[i++] - '0');
+				if (value > (kMaxValue - digit) / 10)
+					return {};
+				value = value * 10 + digit;
+			}
+
+			if (i < text.size())
+			{
+				Size multiplier = 1;
+				switch (text[i])
+				{
+				case 'k': case 'K': multiplier = Size(1024); i++; break;
+				case 'm': case 'M': multiplier = Size(1024) * 1024; i++; break;
+				case 'g': case 'G': multiplier = Size(1024) * 1024 * 1024; i++; break;
+				default: break;
+				}
+				if (value > kMaxValue / multiplier)
+					return {};
+				value *= multiplier;
+			}
+			values.push_back(value);
+		}
+
+		if (values.empty() || values.size() % 2 != 0)
+			return {};
+
+		std::vector<PoolSizeConstructor> sizeClasses;
+		for (size_t v = 0; v < values.size(); v += 2)
+		{
+			if (values[v] == 0 || values[v + 1] == 0)
+				return {};
+			if (alignment > 1 && values[v] % alignment != 0)
+				return {};
+			sizeClasses.emplace_back(values[v], values[v + 1]);
+		}
+
+		SizeClassTable table(std::move(sizeClasses));
+		if (!table.IsValid())
+			return {};
+		return table;
+	}
+
+	std::optional<SizeClassTable> SizeClassTable::FromFile(const std::string& path, Size alignment)
+	{
+		std::ifstream file(path);
+		if (!file)
+			return {};
+		std::stringstream contents;
+		contents << file.rdbuf();
+		return FromString(contents.str(), alignment);
+	}
+
+	const std::optional<SizeClassTable>& SizeClassTable::FromEnvironment()
+	{
+		static const std::optional<SizeClassTable> s_table = []() -> std::optional<SizeClassTable>
+		{
+			if (auto inlineTable = ReadEnvironmentVariable(kEnvironmentTable))
+			{
+				if (auto table = FromString(*inlineTable))
+					return table;
+			}
+			if (auto path = ReadEnvironmentVariable(kEnvironmentFile))
+			{
+				if (auto table = FromFile(*path))
+					return table;
+			}
+			return {};
+		}();
+		return s_table;
+	}
+}
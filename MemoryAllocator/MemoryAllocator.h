@@ -1,13 +1,30 @@
 #pragma once
 #include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
 #include <vector>
 #include <mutex>
 #include <memory>
 #include <array>
 #include <optional>
-#include <list>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+#include <map>
+#include <string>
 #include <type_traits>
 #include <typeinfo>
+#include <new>
+#include <atomic>
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+#include "EpochReclaimer.h"
+#include "LatencyHistogram.h"
+#include "HeapProfiler.h"
+#include "AllocatorProbes.h"
 
 namespace Templated
 {
@@ -17,10 +34,377 @@ namespace Templated
 		{
 
 		}
-		const size_t kPoolSize = 0;
-		const size_t kPoolCount = 0;
-		const size_t kBlockTotalSize = 0;
+		size_t kPoolSize = 0;
+		size_t kPoolCount = 0;
+		size_t kBlockTotalSize = 0;
 	};
+
+	//Controls how many blocks each new pool of a class gets.
+	//Fixed matches kPoolCount for every pool, Geometric doubles each new pool up to kMaxPoolSizeBytes.
+	//Start small begins classes whose full pool would exceed kStartSmallThresholdBytes at a single block and doubles back up from there.
+	struct GrowthPolicy
+	{
+		enum class Mode
+		{
+			Fixed,
+			Geometric
+		};
+
+		Mode m_mode = Mode::Fixed;
+		size_t m_maxPoolSizeBytes = 1024 * 1024 * 64;
+		bool m_bStartSmall = false;
+		size_t m_startSmallThresholdBytes = 1024 * 1024 * 16;
+
+		inline size_t FirstPoolBlockCount(const PoolSizeConstructor& sizeClass) const
+		{
+			if (m_bStartSmall && sizeClass.kBlockTotalSize > m_startSmallThresholdBytes)
+				return 1;
+			return sizeClass.kPoolCount;
+		}
+
+		inline size_t NextPoolBlockCount(const PoolSizeConstructor& sizeClass, size_t previousBlockCount) const
+		{
+			size_t maxBlockCount = sizeClass.kPoolCount;
+			if (m_mode == Mode::Geometric)
+				maxBlockCount = (std::max)(maxBlockCount, m_maxPoolSizeBytes / sizeClass.kPoolSize);
+			return (std::min)(previousBlockCount * 2, maxBlockCount);
+		}
+	};
+
+	//When a class has no free blocks, look at the next m_maxClassesAhead classes for a free block in an existing pool before creating a new one.
+	//A larger block is only used when the bytes left unused stay within m_maxWasteFraction of that block.
+	struct BorrowPolicy
+	{
+		bool m_bEnabled = false;
+		size_t m_maxClassesAhead = 2;
+		float m_maxWasteFraction = 0.5f;
+
+		//Only borrow once growing the class would take committed memory past m_nearBudgetFraction of the memory budget
+		bool m_bOnlyNearBudget = false;
+		float m_nearBudgetFraction = 0.9f;
+
+		inline bool AcceptsBlock(size_t memorySize, size_t blockSize) const
+		{
+			return static_cast<float>(blockSize - memorySize) <= m_maxWasteFraction * static_cast<float>(blockSize);
+		}
+	};
+
+	//Slab colouring for small classes. Each new pool of a class with blocks no larger than m_maxBlockSize starts its first block
+	//a rotating number of cache lines into the pool, up to m_maxColorBytes, so the same block in different pools lands in different cache sets.
+	struct ColoringPolicy
+	{
+		bool m_bEnabled = false;
+		size_t m_cacheLineSize = 64;
+		size_t m_maxColorBytes = 4096;
+		size_t m_maxBlockSize = 4096;
+
+		inline size_t ColorCount(size_t blockSize) const
+		{
+			if (!m_bEnabled || blockSize > m_maxBlockSize || m_cacheLineSize == 0)
+				return 1;
+			return (std::max)(m_maxColorBytes / m_cacheLineSize, size_t(1));
+		}
+	};
+
+	//Per thread slab ownership for classes with blocks no larger than m_maxBlockSize. A thread only allocates from pools it created,
+	//or empty pools it adopts, and blocks are padded out to whole cache lines from a cache line aligned start so no two threads share a line.
+	struct ThreadSlabPolicy
+	{
+		bool m_bEnabled = false;
+		size_t m_cacheLineSize = 64;
+		size_t m_maxBlockSize = 4096;
+
+		inline bool AppliesTo(size_t blockSize) const { return m_bEnabled && blockSize <= m_maxBlockSize; }
+		inline size_t BlockStride(size_t blockSize) const
+		{
+			if (!AppliesTo(blockSize) || m_cacheLineSize == 0)
+				return blockSize;
+			return (blockSize + m_cacheLineSize - 1) / m_cacheLineSize * m_cacheLineSize;
+		}
+	};
+
+	enum class PurgeMode
+	{
+		Lazy,		//Pages may be reclaimed by the OS whenever it wants them, eg MADV_FREE
+		Now			//Pages are dropped immediately, eg MADV_DONTNEED
+	};
+
+	//Optional T_ALLOCATOR hooks, detected at compile time and only called by the pools when present.
+	//Memory Reserve(Size)					Address space for a pool, blocks are committed as they are first handed out. Needs Commit, released with Free.
+	//bool Commit(Memory, Size)				Backs a reserved or decommitted range, false when the platform refuses.
+	//void Decommit(Memory, Size)			Drops the backing of a range that stays reserved, used instead of PurgeMode::Now by decay.
+	//void Purge(Memory, Size, PurgeMode)	Gives idle pages back without unmapping them.
+	//bool IsZeroed(Memory, Size)			Whether memory fresh from Allocate or Reserve reads back as zero, lets AllocateZeroed skip the fill.
+	//void Copy(Memory, Memory, Size)		Lets Compact move blocks. Allocators over memory that must never be touched leave it out.
+	template<typename T_ALLOCATOR, typename = void>
+	struct HasReserve : std::false_type {};
+	template<typename T_ALLOCATOR>
+	struct HasReserve<T_ALLOCATOR, std::void_t<decltype(std::declval<T_ALLOCATOR&>().Reserve(std::declval<typename T_ALLOCATOR::Size>()))>> : std::true_type {};
+
+	template<typename T_ALLOCATOR, typename = void>
+	struct HasCommit : std::false_type {};
+	template<typename T_ALLOCATOR>
+	struct HasCommit<T_ALLOCATOR, std::void_t<decltype(std::declval<T_ALLOCATOR&>().Commit(std::declval<typename T_ALLOCATOR::Memory>(), std::declval<typename T_ALLOCATOR::Size>()))>> : std::true_type {};
+
+	template<typename T_ALLOCATOR, typename = void>
+	struct HasDecommit : std::false_type {};
+	template<typename T_ALLOCATOR>
+	struct HasDecommit<T_ALLOCATOR, std::void_t<decltype(std::declval<T_ALLOCATOR&>().Decommit(std::declval<typename T_ALLOCATOR::Memory>(), std::declval<typename T_ALLOCATOR::Size>()))>> : std::true_type {};
+
+	template<typename T_ALLOCATOR, typename = void>
+	struct HasPurge : std::false_type {};
+	template<typename T_ALLOCATOR>
+	struct HasPurge<T_ALLOCATOR, std::void_t<decltype(std::declval<T_ALLOCATOR&>().Purge(std::declval<typename T_ALLOCATOR::Memory>(), std::declval<typename T_ALLOCATOR::Size>(), PurgeMode::Lazy))>> : std::true_type {};
+
+	template<typename T_ALLOCATOR, typename = void>
+	struct HasCopy : std::false_type {};
+	template<typename T_ALLOCATOR>
+	struct HasCopy<T_ALLOCATOR, std::void_t<decltype(std::declval<T_ALLOCATOR&>().Copy(std::declval<typename T_ALLOCATOR::Memory>(), std::declval<typename T_ALLOCATOR::Memory>(), std::declval<typename T_ALLOCATOR::Size>()))>> : std::true_type {};
+
+	template<typename T_ALLOCATOR, typename = void>
+	struct HasIsZeroed : std::false_type {};
+	template<typename T_ALLOCATOR>
+	struct HasIsZeroed<T_ALLOCATOR, std::void_t<decltype(std::declval<T_ALLOCATOR&>().IsZeroed(std::declval<typename T_ALLOCATOR::Memory>(), std::declval<typename T_ALLOCATOR::Size>()))>> : std::true_type {};
+
+	//Backends declaring kAlignedBlocks = true need every block to start on a kAlignment boundary, eg for O_DIRECT. MemoryAllocator then only
+	//accepts size classes that are multiples of kAlignment and refuses a ColoringPolicy, which would shift blocks off the boundary.
+	template<typename T_ALLOCATOR, typename = void>
+	struct RequiresAlignedBlocks : std::false_type {};
+	template<typename T_ALLOCATOR>
+	struct RequiresAlignedBlocks<T_ALLOCATOR, std::void_t<decltype(T_ALLOCATOR::kAlignedBlocks)>> : std::integral_constant<bool, T_ALLOCATOR::kAlignedBlocks> {};
+
+	//Reserve is only used alongside Commit, Decommit only when blocks can be committed again
+	template<typename T_ALLOCATOR>
+	constexpr bool kUsesReserve = HasReserve<T_ALLOCATOR>::value && HasCommit<T_ALLOCATOR>::value;
+	template<typename T_ALLOCATOR>
+	constexpr bool kUsesDecommit = HasDecommit<T_ALLOCATOR>::value && HasCommit<T_ALLOCATOR>::value;
+
+#if defined(__cpp_concepts) && __cpp_concepts >= 201907L
+	//What every T_ALLOCATOR provides, the hooks above are optional on top. kPoolSizes is only needed by the MemoryAllocator constructor that doesn't take a SizeClassTable.
+	template<typename T_ALLOCATOR>
+	concept PlatformAllocator = requires(T_ALLOCATOR& allocator, typename T_ALLOCATOR::Memory memory, typename T_ALLOCATOR::Size size)
+	{
+		typename T_ALLOCATOR::Type;
+		requires std::is_convertible_v<decltype(T_ALLOCATOR::kMemoryDefault), typename T_ALLOCATOR::Memory>;
+		requires std::is_convertible_v<decltype(T_ALLOCATOR::kAlignment), typename T_ALLOCATOR::Size>;
+		requires std::is_convertible_v<decltype(T_ALLOCATOR::kMaxAllocationSize), typename T_ALLOCATOR::Size>;
+		requires std::is_same_v<decltype(allocator.Allocate(size, size)), typename T_ALLOCATOR::Memory>;
+		requires std::is_same_v<decltype(allocator.Offset(memory, size)), typename T_ALLOCATOR::Memory>;
+		allocator.Free(memory, size);
+		memory == memory;
+	};
+#define BLOCK_ALLOCATOR_PLATFORM_ALLOCATOR PlatformAllocator
+#else
+#define BLOCK_ALLOCATOR_PLATFORM_ALLOCATOR typename
+#endif
+
+	//Time based decay of idle memory driven by MemoryAllocator::Tick or its decay thread.
+	//Free blocks of at least m_purgeGranularity bytes and empty pools are lazily purged, then purged, and empty pools are finally released.
+	//Purging needs T_ALLOCATOR::Purge, without it only the release stage applies.
+	struct DecayPolicy
+	{
+		bool m_bEnabled = false;
+		std::chrono::milliseconds m_lazyPurgeAfter{ 1000 };
+		std::chrono::milliseconds m_purgeAfter{ 5000 };
+		std::chrono::milliseconds m_releaseAfter{ 30000 };
+		size_t m_purgeGranularity = 4096;
+	};
+
+	enum class AllocationError
+	{
+		None,
+		TooLarge,			//Larger than T_ALLOCATOR::kMaxAllocationSize
+		OutOfBudget,		//Memory budget reached after trimming and low memory callbacks
+		PlatformFailure		//T_ALLOCATOR::Allocate returned kMemoryDefault
+	};
+
+	//Pool bookkeeping in a form a platform allocator can store, see MemoryAllocator::ExportPools and ImportPools.
+	//Blocks live when exported come back as raw blocks, handles don't outlive the process.
+	template<typename T_MEMORY>
+	struct PersistedPool
+	{
+		uint64_t m_blockSize = 0;
+		uint64_t m_blockStride = 0;
+		uint64_t m_poolBytes = 0;
+		uint64_t m_colorOffset = 0;
+		T_MEMORY m_memory{};
+		std::vector<uint32_t> m_types;			//T_ALLOCATOR::Type per block
+		std::vector<uint32_t> m_freeBlocks;		//In allocation order
+	};
+
+	template<typename T_MEMORY>
+	struct PersistedHeap
+	{
+		std::vector<PersistedPool<T_MEMORY>> m_pools;
+		std::vector<std::pair<T_MEMORY, uint64_t>> m_largeAllocations;		//Raw large allocations only
+	};
+
+	//Bookkeeping cost of one size class, see MemoryAllocator::GetMetadataOverhead
+	struct ClassMetadataOverhead
+	{
+		size_t m_blockSize = 0;
+		size_t m_poolCount = 0;
+		size_t m_blockCount = 0;
+		size_t m_metadataBytes = 0;		//Pool headers with their packed block states, side tables and the class's pool index
+	};
+
+	//Point in time view of one size class, see MemoryAllocator::GetStatsSnapshot. Latency is indexed by LatencyEvent
+	//and only filled in while a LatencyPolicy is enabled.
+	struct ClassStats
+	{
+		size_t m_blockSize = 0;			//0 for the entry covering allocations too large for any class
+		size_t m_poolCount = 0;
+		size_t m_blockCount = 0;
+		std::array<LatencySummary, kLatencyEventCount> m_latency = {};
+	};
+
+	struct AllocatorStats
+	{
+		size_t m_committedBytes = 0;
+		size_t m_budgetBytes = 0;
+		size_t m_largeAllocationBytes = 0;
+		std::vector<ClassStats> m_classes;		//One per size class, then one for large allocations
+	};
+
+	//One pool of a ClassFragmentation
+	struct PoolOccupancy
+	{
+		size_t m_poolBytes = 0;
+		size_t m_blockCount = 0;
+		size_t m_allocatedCount = 0;
+		size_t m_untouchedCount = 0;		//Never handed out, these sit above the pool's bump watermark
+		size_t m_decommittedCount = 0;		//Free blocks decay already returned to the OS
+		size_t m_longestFreeRun = 0;
+		size_t m_requestedBytes = 0;		//Summed over live blocks with a recorded size, see MemoryAllocator::TrackRequestedBytes
+		uint64_t m_slabOwner = 0;
+		bool m_bReclaimable = false;		//No live blocks, TrimEmptyPools would release it
+		bool m_bCompactable = false;		//Compact would move every live block into denser pools and release it
+
+		inline float Occupancy() const { return m_blockCount ? static_cast<float>(m_allocatedCount) / static_cast<float>(m_blockCount) : 0.0f; }
+	};
+
+	struct ClassFragmentation
+	{
+		static constexpr size_t kRunBuckets = 32;
+
+		size_t m_blockSize = 0;
+		size_t m_allocatedCount = 0;
+		size_t m_freeCount = 0;
+		size_t m_trackedCount = 0;			//Live blocks with a recorded requested size
+		size_t m_requestedBytes = 0;		//Requested bytes of the tracked blocks
+		std::array<size_t, kRunBuckets> m_freeRuns = {};		//Entry i counts maximal runs of free blocks with length in [2^i, 2^(i+1))
+		std::vector<PoolOccupancy> m_pools;
+
+		//Free space inside live blocks, only over the tracked ones
+		inline size_t InternalWasteBytes() const { return m_trackedCount * m_blockSize - m_requestedBytes; }
+		inline size_t FreeBytes() const { return m_freeCount * m_blockSize; }
+		size_t ReclaimableBytes() const
+		{
+			size_t bytes = 0;
+			for (const PoolOccupancy& pool : m_pools)
+				bytes += pool.m_bReclaimable || pool.m_bCompactable ? pool.m_poolBytes : 0;
+			return bytes;
+		}
+	};
+
+	//See MemoryAllocator::AnalyzeFragmentation
+	struct FragmentationReport
+	{
+		size_t m_committedBytes = 0;
+		size_t m_largeAllocationBytes = 0;
+		std::vector<ClassFragmentation> m_classes;
+
+		size_t FreeBytes() const
+		{
+			size_t bytes = 0;
+			for (const ClassFragmentation& fragmentation : m_classes)
+				bytes += fragmentation.FreeBytes();
+			return bytes;
+		}
+		size_t ReclaimableBytes() const
+		{
+			size_t bytes = 0;
+			for (const ClassFragmentation& fragmentation : m_classes)
+				bytes += fragmentation.ReclaimableBytes();
+			return bytes;
+		}
+	};
+
+	//Runtime size class table. Built once from either the compiled in kPoolSizes or a deployment config
+	//and flattened into two dense lookup tables so mapping a size to its class stays O(1).
+	class SizeClassTable
+	{
+	public:
+		using Size = std::size_t;
+		static constexpr Size kInvalidClass = ~Size(0);
+		static constexpr Size kMaxClassCount = 255;
+		static constexpr Size kFineGranularityShift = 8;		//256 bytes per entry
+		static constexpr Size kCoarseGranularityShift = 16;		//64kb per entry
+		static constexpr Size kFineLimit = Size(1) << kCoarseGranularityShift;
+
+		//Environment variables consulted by LoadOrDefault, only for backends opting in through UsesEnvironmentSizeClasses.
+		//BLOCK_ALLOCATOR_SIZE_CLASSES holds the table inline, eg "256x1024,512x1024,1Mx32"
+		//BLOCK_ALLOCATOR_SIZE_CLASSES_FILE holds a path to a file in the same format, one class per line
+		static constexpr const char* kEnvironmentTable = "BLOCK_ALLOCATOR_SIZE_CLASSES";
+		static constexpr const char* kEnvironmentFile = "BLOCK_ALLOCATOR_SIZE_CLASSES_FILE";
+
+		SizeClassTable() = default;
+		explicit SizeClassTable(std::vector<PoolSizeConstructor> sizeClasses);
+
+		template<size_t N>
+		explicit SizeClassTable(const PoolSizeConstructor(&sizeClasses)[N]) : SizeClassTable(std::vector<PoolSizeConstructor>(sizeClasses, sizeClasses + N))
+		{
+
+		}
+
+		//Parses "size count" pairs. Sizes accept a K/M/G suffix, pairs may be separated by whitespace, ',', ';', ':' or 'x' and '#' starts a comment.
+		//Fails on values that overflow Size and on sizes that aren't a multiple of alignment.
+		static std::optional<SizeClassTable> FromString(const std::string& text, Size alignment = 1);
+		static std::optional<SizeClassTable> FromFile(const std::string& path, Size alignment = 1);
+
+		//Read and parsed once, the first call caches the result for the life of the process
+		static const std::optional<SizeClassTable>& FromEnvironment();
+
+		//Environment/file config when present, valid and a multiple of alignment throughout, otherwise the compiled in table.
+		template<size_t N>
+		static SizeClassTable LoadOrDefault(const PoolSizeConstructor(&defaultClasses)[N], Size alignment)
+		{
+			const std::optional<SizeClassTable>& table = FromEnvironment();
+			if (table && table->IsAlignedTo(alignment))
+				return *table;
+			return SizeClassTable(defaultClasses);
+		}
+
+		inline Size ClassIndexForSize(Size memorySize) const
+		{
+			if (memorySize == 0)
+				memorySize = 1;
+			if (memorySize > m_maxBlockSize)
+				return kInvalidClass;
+
+			Size classIdx = memorySize <= kFineLimit ? m_fineLookup[(memorySize - 1) >> kFineGranularityShift] : m_coarseLookup[(memorySize - 1) >> kCoarseGranularityShift];
+			//Only walks when a class boundary doesn't sit on the lookup granularity
+			while (m_classes[classIdx].kPoolSize < memorySize)
+				classIdx++;
+			return classIdx;
+		}
+
+		inline const PoolSizeConstructor& operator[](Size classIdx) const { return m_classes[classIdx]; }
+		inline Size Count() const { return m_classes.size(); }
+		inline Size MaxBlockSize() const { return m_maxBlockSize; }
+		inline bool IsValid() const { return m_classes.size() > 0; }
+		bool IsAlignedTo(Size alignment) const
+		{
+			return std::all_of(m_classes.begin(), m_classes.end(), [alignment](const PoolSizeConstructor& c) { return alignment == 0 || c.kPoolSize % alignment == 0; });
+		}
+
+	private:
+		std::vector<PoolSizeConstructor> m_classes;
+		std::vector<uint8_t> m_fineLookup;
+		std::vector<uint8_t> m_coarseLookup;
+		Size m_maxBlockSize = 0;
+	};
+
 	struct CPPAllocator
 	{
 	public:
@@ -40,9 +424,9 @@ namespace Templated
 		static constexpr Size kMaxAllocationSize = 1024 * 1024 * 128;
 		static constexpr Size kMaxAllocationCount = 1;
 
-		//NOTE TO SELF USE SELF DEFINED ARRAYS
-		static constexpr PoolSizeConstructor kPoolSizes[] = 
-		{ 
+		//Default table, CPPAllocator and MMapAllocator let SizeClassTable::kEnvironmentTable/kEnvironmentFile override it
+		static constexpr PoolSizeConstructor kPoolSizes[] =
+		{
 			//Size, Count
 			{256, 1024},
 			{512, 1024},
@@ -83,13 +467,48 @@ namespace Templated
 		{
 			return ((char*)memoryIn) + blockSize;
 		}
+		//Inverse of Offset, used by the sized Free to find a block from its address
+		inline Size Distance(Memory memoryBase, Memory memoryIn)
+		{
+			return static_cast<Size>((char*)memoryIn - (char*)memoryBase);
+		}
 		void Free(Memory pMemory)
 		{
 			free(pMemory);
 		}
+		void Free(Memory pMemory, Size /*memorySize*/)
+		{
+			free(pMemory);
+		}
+		inline void Copy(Memory pDestination, Memory pSource, Size memorySize)
+		{
+			memcpy(pDestination, pSource, memorySize);
+		}
+		//Only needed by AllocateZeroed
+		inline void Zero(Memory pDestination, Size memorySize)
+		{
+			memset(pDestination, 0, memorySize);
+		}
+	};
+
+	//Bits of packed state a pool keeps per block, see PoolList::Pool. CPPAllocator::Type and allocators declaring kTypeCount <= 8
+	//alongside their own Type get 4 bits a block, anything else a byte, which leaves 7 bits for the Type value.
+	template<typename T_ALLOCATOR, typename = void>
+	struct BlockStateBits : std::integral_constant<size_t, std::is_same<typename T_ALLOCATOR::Type, CPPAllocator::Type>::value ? 4 : 8> {};
+	template<typename T_ALLOCATOR>
+	struct BlockStateBits<T_ALLOCATOR, std::void_t<decltype(T_ALLOCATOR::kTypeCount)>> : std::integral_constant<size_t, T_ALLOCATOR::kTypeCount <= 8 ? 4 : 8>
+	{
+		static_assert(T_ALLOCATOR::kTypeCount <= 128, "Type values must fit in 7 bits");
 	};
 
+	//Backends whose default constructed MemoryAllocator takes its size classes from SizeClassTable::kEnvironmentTable/kEnvironmentFile.
+	//Off unless specialised so backends with layout constraints, page multiple classes or pools persisted against their classes, keep their own table.
 	template<typename T_ALLOCATOR>
+	struct UsesEnvironmentSizeClasses : std::false_type {};
+	template<>
+	struct UsesEnvironmentSizeClasses<CPPAllocator> : std::true_type {};
+
+	template<BLOCK_ALLOCATOR_PLATFORM_ALLOCATOR T_ALLOCATOR>
 	class MemoryAllocator
 	{
 	public:
@@ -105,174 +524,2214 @@ namespace Templated
 
 			~LocalAllocation()
 			{
-				if (m_poolAllocatedFrom)
-					m_poolAllocatedFrom->Deallocate(blockIdx);
+				if (m_owner)
+					m_owner->Release(*this);
 			}
+			inline bool IsValid() const { return m_error == AllocationError::None; }
+
+			//Forgets the block without returning it, the owner must already have released it
+			inline void Reset()
+			{
+				m_platformMemory = T_ALLOCATOR::kMemoryDefault;
+				blockIdx = ~0;
+				m_poolAllocatedFrom = nullptr;
+				m_owner = nullptr;
+				m_pinCount = 0;
+				m_largeAllocationSize = 0;
+				m_error = AllocationError::None;
+				m_bRaw = false;
+				m_bZeroed = false;
+				m_handleIdx = kNoHandle;
+			}
+
+			static constexpr uint32_t kNoHandle = ~0u;
+
 			size_t blockIdx = ~0;
-			std::shared_ptr<PoolBase> m_poolAllocatedFrom;
+			PoolBase* m_poolAllocatedFrom = nullptr;		//Outlives the block, pools are only released once empty
+			MemoryAllocator* m_owner = nullptr;
+			size_t m_pinCount = 0;					//Compact never moves a pinned block
+			size_t m_largeAllocationSize = 0;		//Non zero when allocated directly from T_ALLOCATOR rather than a pool
+			AllocationError m_error = AllocationError::None;
+			bool m_bRaw = false;					//Filled in for AllocateRaw, the block is left without an owner
+			bool m_bZeroed = false;					//Block came from fresh memory T_ALLOCATOR::IsZeroed vouched for
+			uint32_t m_handleIdx = kNoHandle;		//Handle table slot whose published memory follows this block, see Resolve
 		};
 		using Memory = std::shared_ptr<LocalAllocation>;
-		
-		MemoryAllocator(T_ALLOCATOR& platformAllocator) : m_allocator(platformAllocator), m_firstPool(platformAllocator) {	}
-		~MemoryAllocator() { }
 
-		Memory Allocate(typename T_ALLOCATOR::Size memorySize, typename T_ALLOCATOR::Type memoryType)
+		//32 bit generation checked reference into the handle table, see EnableHandleTable and Resolve for the generation's limit
+		struct Handle
 		{
-			return m_firstPool.Allocate(memorySize, memoryType);
-		}
+			static constexpr uint32_t kIndexBits = 24;
+			static constexpr uint32_t kIndexMask = (1u << kIndexBits) - 1;
+			static constexpr uint32_t kGenerationMask = 0xFFu;
 
-		template<typename T>
-		void DebugPrint(T& dbgPrint, bool bOnlyPrintActivePools)
-		{
-			dbgPrint << "Memory Allocator Info:" << "\n";
-			m_firstPool.DebugPrint(1, dbgPrint, bOnlyPrintActivePools);
+			Handle() = default;
+			Handle(uint32_t index, uint32_t generation) : m_value((generation << kIndexBits) | index) { }
 
-		}
+			inline uint32_t Index() const { return m_value & kIndexMask; }
+			inline uint32_t Generation() const { return m_value >> kIndexBits; }
+			inline bool IsNull() const { return m_value == 0; }
+			inline bool operator==(const Handle& other) const { return m_value == other.m_value; }
+			inline bool operator!=(const Handle& other) const { return m_value != other.m_value; }
 
-	private:
-		template<typename POOL_ALLOCATOR, size_t T_ARRAY_IDX, bool T_BOOL>
-		struct PoolList
-		{
-			static constexpr auto kBlockSize = POOL_ALLOCATOR::kPoolSizes[T_ARRAY_IDX].kPoolSize;
-			static constexpr auto kBlockCount = POOL_ALLOCATOR::kPoolSizes[T_ARRAY_IDX].kPoolCount;
-			static constexpr auto kPoolSizeBytes = kBlockSize * kBlockCount;
+			//Generation 0 is never used so a zero handle is always null
+			static inline uint32_t NextGeneration(uint32_t generation) { return (generation & kGenerationMask) == kGenerationMask ? 1 : generation + 1; }
 
-			PoolList(T_ALLOCATOR& platformAllocator) : m_platformAllocator(platformAllocator), m_nextPool(platformAllocator)
-			{
+			uint32_t m_value = 0;
+		};
+		static_assert(sizeof(Handle) == sizeof(uint32_t), "Handle must stay 32 bits");
 
+		//Counted view of part of a pool block, see AllocateBuffer. Copies and slices share the block through a count kept in the pool's
+		//per block metadata, never copying the bytes, and the block goes back to its pool when the last reference drops.
+		//Counting is lock free, only the final release takes the allocator lock.
+		class BufferRef
+		{
+		public:
+			BufferRef() = default;
+			BufferRef(const BufferRef& other) : m_owner(other.m_owner), m_pool(other.m_pool), m_blockIdx(other.m_blockIdx), m_data(other.m_data), m_offset(other.m_offset), m_length(other.m_length)
+			{
+				if (m_pool)
+					RefCount().fetch_add(1, std::memory_order_relaxed);
 			}
-
-			inline Memory Allocate(typename T_ALLOCATOR::Size memorySize, typename T_ALLOCATOR::Type memoryType)
+			BufferRef(BufferRef&& other) noexcept : m_owner(other.m_owner), m_pool(other.m_pool), m_blockIdx(other.m_blockIdx), m_data(other.m_data), m_offset(other.m_offset), m_length(other.m_length)
+			{
+				other.Forget();
+			}
+			BufferRef& operator=(const BufferRef& other)
 			{
-				if (memorySize <= kBlockSize)
+				if (this != &other)
 				{
-					Memory newMem = std::make_shared<LocalAllocation>();
-
-					if (m_pools.size() == 0)
-						AddNewPool();
-
-					for (auto& pool : m_pools)
-					{
-						auto allocation = pool->Allocate(memoryType);
-						if (allocation)
-						{
-							newMem->blockIdx = *allocation;
-							newMem->m_poolAllocatedFrom = std::static_pointer_cast<PoolBase>(pool);
-							newMem->m_platformMemory = m_platformAllocator.Offset(pool->m_platformMemory, newMem->blockIdx * kBlockSize);
-							return newMem;
-						}
-					}
-
-					AddNewPool();
-					newMem->blockIdx = m_pools.back()->Allocate(memoryType).value_or(~0);
-
-					return newMem;
+					BufferRef copy(other);
+					*this = std::move(copy);
 				}
-				else
+				return *this;
+			}
+			BufferRef& operator=(BufferRef&& other) noexcept
+			{
+				if (this != &other)
 				{
-					return m_nextPool.Allocate(memorySize, memoryType);
+					Reset();
+					m_owner = other.m_owner;
+					m_pool = other.m_pool;
+					m_blockIdx = other.m_blockIdx;
+					m_data = other.m_data;
+					m_offset = other.m_offset;
+					m_length = other.m_length;
+					other.Forget();
 				}
+				return *this;
+			}
+			~BufferRef()
+			{
+				Reset();
 			}
 
-			inline auto AddNewPool()
+			//Drops this reference, the block is freed if it was the last
+			void Reset()
 			{
-				m_pools.push_back(std::make_shared<Pool>());
-				auto& newPool = m_pools.back();
-				newPool->m_platformMemory = m_platformAllocator.Allocate(kBlockSize * kBlockCount, POOL_ALLOCATOR::kAlignment);
-				return newPool;
+				if (m_pool && RefCount().fetch_sub(1, std::memory_order_acq_rel) == 1)
+					m_owner->ReleaseBufferBlock(*m_pool, m_blockIdx);
+				Forget();
 			}
 
-			template<typename T>
-			inline void DebugPrint(size_t poolNumber, T& dbgPrint, bool bOnlyPrintActivePools)
+			//Another reference to [offset, offset + length) of this view, clamped to the view
+			BufferRef Slice(size_t offset, size_t length) const
 			{
-				if (!bOnlyPrintActivePools || (bOnlyPrintActivePools && m_pools.size() > 0))
-				{
-					dbgPrint.precision(4);
-						dbgPrint << "#" << poolNumber << "  ";
-						dbgPrint << (size_t)kBlockSize;
-						dbgPrint << "(" << static_cast<float>(kBlockSize) / 1024.0f / 1024.0f << "mb)";
-						dbgPrint << "x";
-						dbgPrint << (size_t)kBlockCount;
-						dbgPrint << "=" << static_cast<size_t>(kBlockSize * kBlockCount);
-						dbgPrint << "(" << static_cast<float>(kBlockSize * kBlockCount) / 1024.0f / 1024.0f << "mb)";
-						dbgPrint << "\n";
-						dbgPrint << "Pool Count:" << m_pools.size() << "\n";
-				}
-				m_nextPool.DebugPrint<T>(poolNumber + 1, dbgPrint, bOnlyPrintActivePools);
+				if (!m_pool)
+					return BufferRef();
+				offset = (std::min)(offset, m_length);
+				BufferRef slice(*this);
+				slice.m_data = m_owner->m_allocator.Offset(m_data, offset);
+				slice.m_offset = m_offset + offset;
+				slice.m_length = (std::min)(length, m_length - offset);
+				return slice;
 			}
 
-			struct Pool : public PoolBase
+			inline typename T_ALLOCATOR::Memory Data() const { return m_data; }
+			inline size_t Size() const { return m_length; }
+			inline size_t OffsetInBlock() const { return m_offset; }
+			inline bool IsNull() const { return m_pool == nullptr; }
+			inline explicit operator bool() const { return m_pool != nullptr; }
+			//References to the block, including slices of it
+			inline uint32_t UseCount() const { return m_pool ? RefCount().load(std::memory_order_relaxed) : 0; }
+
+		private:
+			friend class MemoryAllocator;
+
+			inline std::atomic<uint32_t>& RefCount() const { return static_cast<typename PoolList::Pool*>(m_pool)->m_bufferRefs[m_blockIdx]; }
+			inline void Forget()
+			{
+				m_owner = nullptr;
+				m_pool = nullptr;
+				m_blockIdx = 0;
+				m_data = T_ALLOCATOR::kMemoryDefault;
+				m_offset = 0;
+				m_length = 0;
+			}
+
+			MemoryAllocator* m_owner = nullptr;
+			PoolBase* m_pool = nullptr;
+			size_t m_blockIdx = 0;
+			typename T_ALLOCATOR::Memory m_data = T_ALLOCATOR::kMemoryDefault;
+			size_t m_offset = 0;
+			size_t m_length = 0;
+		};
+		//A Retire()d allocation and the pin keeping Compact from moving it, dropped just before the allocation is released
+		class RetiredMemory
+		{
+		public:
+			RetiredMemory(MemoryAllocator& allocator, Memory memory) : m_allocator(&allocator), m_memory(std::move(memory)) { }
+			RetiredMemory(RetiredMemory&&) = default;
+			RetiredMemory& operator=(RetiredMemory&& other) noexcept
 			{
-				Pool()
+				if (this != &other)
 				{
-					for (size_t i = 0; i < kBlockCount; i++)
-						m_allocationList.push_back(i);					
+					Release();
+					m_allocator = other.m_allocator;
+					m_memory = std::move(other.m_memory);
 				}
+				return *this;
+			}
+			~RetiredMemory() { Release(); }
+		private:
+			void Release()
+			{
+				if (m_memory)
+					m_allocator->Unpin(m_memory);
+				m_memory.reset();
+			}
+			MemoryAllocator* m_allocator;
+			Memory m_memory;
+		};
+		using EpochGuard = typename EpochReclaimer<RetiredMemory>::Guard;
+		using LowMemoryCallback = std::function<void(typename T_ALLOCATOR::Size bytesRequested)>;
+		using CallbackId = size_t;
 
-				std::array<typename T_ALLOCATOR::Type, kBlockCount> m_typeList = {};
-				std::list<size_t> m_allocationList = {};
-				typename T_ALLOCATOR::Memory m_platformMemory = T_ALLOCATOR::kMemoryDefault;
+		MemoryAllocator(T_ALLOCATOR& platformAllocator) : MemoryAllocator(platformAllocator, DefaultSizeClasses()) {	}
+		//Backends with RequiresAlignedBlocks fall back to their own kPoolSizes when a class in sizeClasses isn't a multiple of kAlignment
+		MemoryAllocator(T_ALLOCATOR& platformAllocator, SizeClassTable sizeClasses) : m_allocator(platformAllocator), m_sizeClasses(AlignedSizeClasses(std::move(sizeClasses)))
+		{
+			m_poolLists.reserve(m_sizeClasses.Count());
+			for (size_t i = 0; i < m_sizeClasses.Count(); i++)
+				m_poolLists.emplace_back(platformAllocator, m_sizeClasses[i], i, m_latency, m_heapProfiler);
+		}
+		//All Memory handles must have been released before the allocator is destroyed
+		~MemoryAllocator()
+		{
+			StopDecayThread();
+			m_epochReclaimer.ReclaimAll();
+			for (uint32_t i = 0; i < m_handleSlotCount; i++)
+				HandleSlotAt(i)->m_allocation.Reset();
+			for (uint32_t chunkIdx = 0; m_handleChunks && chunkIdx * kHandleChunkSlots < m_handleSlotCount; chunkIdx++)
+				delete[] m_handleChunks[chunkIdx].load(std::memory_order_relaxed);
+			for (auto& large : m_largeRawAllocations)
+				m_allocator.Free(large.first, large.second);
+			for (auto& poolList : m_poolLists)
+				poolList.ReleaseAllPools();
+		}
 
-				virtual void Deallocate(size_t blockIdx) override
-				{
-					m_activeAllocationCount--;
-					m_allocationList.push_back(blockIdx);
-				}
-				std::optional<size_t> Allocate(typename T_ALLOCATOR::Type memoryType)
-				{
-					if (m_activeAllocationCount == kBlockCount)
-						return {};
+		Memory Allocate(typename T_ALLOCATOR::Size memorySize, typename T_ALLOCATOR::Type memoryType)
+		{
+			Memory newMem = std::make_shared<LocalAllocation>();
+			AllocateInto(*newMem, memorySize, memoryType);
+			return newMem;
+		}
 
-					if (m_allocationList.size() == 0)
-						return {};
+		//Raw API, returns the block itself or kMemoryDefault. Raw blocks have no handle to patch so Compact never moves them.
+		//Give them back with Free, passing the size they were allocated with when it's known.
+		typename T_ALLOCATOR::Memory AllocateRaw(typename T_ALLOCATOR::Size memorySize, typename T_ALLOCATOR::Type memoryType)
+		{
+			LocalAllocation allocation;
+			allocation.m_bRaw = true;
+			if (!AllocateInto(allocation, memorySize, memoryType))
+				return T_ALLOCATOR::kMemoryDefault;
+			const auto platformMemory = allocation.m_platformMemory;
+			allocation.Reset();
+			return platformMemory;
+		}
 
-					auto front = m_allocationList.front();
-					m_typeList[front] = memoryType;
-					m_activeAllocationCount++;
-					m_allocationList.pop_front();
-					return front;
+		//A shareable block, null when memorySize doesn't fit a size class or the allocation fails. Like raw blocks, shared blocks have
+		//no handle to patch so Compact never moves them.
+		BufferRef AllocateBuffer(typename T_ALLOCATOR::Size memorySize, typename T_ALLOCATOR::Type memoryType)
+		{
+			BufferRef buffer;
+			if (m_sizeClasses.ClassIndexForSize(memorySize) == SizeClassTable::kInvalidClass)
+				return buffer;
+
+			LocalAllocation allocation;
+			allocation.m_bRaw = true;
+			if (!AllocateInto(allocation, memorySize, memoryType))
+				return buffer;
+
+			auto* pool = static_cast<typename PoolList::Pool*>(allocation.m_poolAllocatedFrom);
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				pool->EnableBufferRefs();
+			}
+			pool->m_bufferRefs[allocation.blockIdx].store(1, std::memory_order_relaxed);
+			buffer.m_owner = this;
+			buffer.m_pool = pool;
+			buffer.m_blockIdx = allocation.blockIdx;
+			buffer.m_data = allocation.m_platformMemory;
+			buffer.m_length = memorySize;
+			allocation.Reset();
+			return buffer;
+		}
+
+		//Sized free for raw blocks. The size picks the class directly and the block is found inside that class's pools by arithmetic,
+		//only falling back to the classes borrowing could have used and then the unsized search when the size doesn't match.
+		void Free(typename T_ALLOCATOR::Memory platformMemory, typename T_ALLOCATOR::Size memorySize)
+		{
+			if (platformMemory == T_ALLOCATOR::kMemoryDefault)
+				return;
+			const size_t classIdx = m_sizeClasses.ClassIndexForSize(memorySize);
+			LatencyScope freeTimer(m_latency, classIdx, LatencyEvent::Free, m_latency.ShouldSample());
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (classIdx != SizeClassTable::kInvalidClass)
+			{
+				const size_t lastClassIdx = (std::min)(m_poolLists.size() - 1, classIdx + (m_borrowPolicy.m_bEnabled ? m_borrowPolicy.m_maxClassesAhead : 0));
+				for (size_t searchIdx = classIdx; searchIdx <= lastClassIdx; searchIdx++)
+				{
+					if (m_poolLists[searchIdx].FreeRaw(platformMemory))
+						return;
 				}
-			private:
-				size_t m_activeAllocationCount = 0;
-			};
+			}
+			FreeRawLocked(platformMemory);
+		}
 
-			std::vector<std::shared_ptr<Pool>> m_pools;
-			T_ALLOCATOR& m_platformAllocator;
+		//Unsized free for raw blocks, searches every class
+		void Free(typename T_ALLOCATOR::Memory platformMemory)
+		{
+			if (platformMemory == T_ALLOCATOR::kMemoryDefault)
+				return;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			FreeRawLocked(platformMemory);
+		}
 
-			static constexpr bool kLAST_VALID_POOL = (T_ARRAY_IDX + 1) < POOL_ALLOCATOR::kArrayTotalSize;
+		//As Allocate but the block reads back as zero. Pinned while it is filled so Compact can't move it mid fill.
+		Memory AllocateZeroed(typename T_ALLOCATOR::Size memorySize, typename T_ALLOCATOR::Type memoryType)
+		{
+			Memory newMem = std::make_shared<LocalAllocation>();
+			newMem->m_pinCount = 1;
+			if (AllocateInto(*newMem, memorySize, memoryType))
+			{
+				if (!newMem->m_bZeroed)
+					m_allocator.Zero(newMem->m_platformMemory, memorySize);
+				std::lock_guard<std::mutex> lock(m_mutex);
+				newMem->m_pinCount--;
+			}
+			else
+			{
+				newMem->m_pinCount = 0;
+			}
+			return newMem;
+		}
 
-			PoolList<POOL_ALLOCATOR, T_ARRAY_IDX + 1, kLAST_VALID_POOL> m_nextPool;
-		};
+		typename T_ALLOCATOR::Memory AllocateRawZeroed(typename T_ALLOCATOR::Size memorySize, typename T_ALLOCATOR::Type memoryType)
+		{
+			LocalAllocation allocation;
+			allocation.m_bRaw = true;
+			if (!AllocateInto(allocation, memorySize, memoryType))
+				return T_ALLOCATOR::kMemoryDefault;
+			const auto platformMemory = allocation.m_platformMemory;
+			if (!allocation.m_bZeroed)
+				m_allocator.Zero(platformMemory, memorySize);
+			allocation.Reset();
+			return platformMemory;
+		}
 
-		template<typename POOL_ALLOCATOR, size_t T_ARRAY_IDX>
-		struct PoolList<POOL_ALLOCATOR, T_ARRAY_IDX, false>
+		//Turning decay off drops the idle stamps, they are started over when it is turned back on
+		void SetDecayPolicy(const DecayPolicy& decayPolicy)
 		{
-			PoolList(T_ALLOCATOR& platformAllocator)
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_decayPolicy.m_bEnabled && !decayPolicy.m_bEnabled)
 			{
+				for (auto& poolList : m_poolLists)
+					poolList.DropIdleStamps();
 			}
+			m_decayPolicy = decayPolicy;
+		}
 
-			template<typename T>
-			inline void DebugPrint(size_t poolNumber, T& dbgPrint, bool bOnlyPrintActivePools)
+		//Advances decay for callers running their own event loop. Free blocks and empty pools are stamped on the first tick that sees them idle,
+		//the purge and release system calls run without the allocator lock held. Returns the bytes released.
+		size_t Tick(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
+		{
+			std::lock_guard<std::mutex> tickLock(m_tickMutex);
+			const uint64_t nowMs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count()) + 1;
+
+			std::vector<DecayWork> decayWork;
+			size_t releasedBytes = 0;
 			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (!m_decayPolicy.m_bEnabled)
+					return 0;
+				for (size_t classIdx = 0; classIdx < m_poolLists.size(); classIdx++)
+					m_poolLists[classIdx].CollectDecayWork(classIdx, nowMs, m_decayPolicy, HasPurge<T_ALLOCATOR>::value || kUsesDecommit<T_ALLOCATOR>, decayWork);
+				for (auto& work : decayWork)
+				{
+					if (work.m_bRelease)
+						releasedBytes += work.m_size;
+				}
+				m_committedBytes -= releasedBytes;
 			}
 
-			Memory Allocate(typename T_ALLOCATOR::Size /*memorySize*/, typename POOL_ALLOCATOR::Type /*memoryType*/)
+			for (auto& work : decayWork)
 			{
-				//Error, allocation too large.
-				return std::make_shared<LocalAllocation>();
+				if (work.m_bRelease)
+				{
+					LatencyScope platformTimer(m_latency, work.m_classIdx, LatencyEvent::PlatformFree, m_latency.IsEnabled());
+					MEMORY_ALLOCATOR_PROBE(pool_release, work.m_size, work.m_classIdx, work.m_platformMemory);
+					m_allocator.Free(work.m_platformMemory, work.m_size);
+				}
+				else
+					Purge(work.m_platformMemory, work.m_size, work.m_purgeMode);
 			}
-		};
 
-		//Specialised Pool to prevent infinite recursive template creation
-		//template<>
-		//struct PoolList<T_ALLOCATOR, 0, 0>
-		//{
-		//
-		//};
-		
-		T_ALLOCATOR&		m_allocator;
-		PoolList<T_ALLOCATOR, 0, true> m_firstPool;
-		std::mutex			m_mutex;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				for (auto& work : decayWork)
+				{
+					if (!work.m_bRelease)
+						m_poolLists[work.m_classIdx].FinishDecayWork(work);
+				}
+			}
+			return releasedBytes;
+		}
+
+		//Calls Tick every interval on a background thread until StopDecayThread or destruction
+		void StartDecayThread(std::chrono::milliseconds interval)
+		{
+			StopDecayThread();
+			m_bStopDecayThread = false;
+			m_decayThread = std::thread([this, interval]()
+			{
+				std::unique_lock<std::mutex> lock(m_decayThreadMutex);
+				while (!m_decayThreadWake.wait_for(lock, interval, [this]() { return m_bStopDecayThread; }))
+				{
+					lock.unlock();
+					Tick();
+					lock.lock();
+				}
+			});
+		}
+
+		void StopDecayThread()
+		{
+			if (!m_decayThread.joinable())
+				return;
+			{
+				std::lock_guard<std::mutex> lock(m_decayThreadMutex);
+				m_bStopDecayThread = true;
+			}
+			m_decayThreadWake.notify_all();
+			m_decayThread.join();
+		}
+
+		//Readers of structures whose blocks are Retire()d hold the returned guard while they may touch those blocks
+		inline EpochGuard EnterEpoch() { return m_epochReclaimer.Enter(); }
+
+		//Defers dropping memory until every reader that entered an epoch before this call has exited it. The block stays pinned until then
+		//so Compact can't move it out from under those readers.
+		void Retire(Memory memory)
+		{
+			if (memory)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				memory->m_pinCount++;
+			}
+			m_epochReclaimer.Retire(RetiredMemory(*this, std::move(memory)));
+		}
+
+		//Returns the number of retired allocations released
+		inline size_t ReclaimRetired() { return m_epochReclaimer.TryReclaim(); }
+		inline void SetRetireBatchSize(size_t batchSize) { m_epochReclaimer.SetBatchSize(batchSize); }
+
+		//Handle table mode with room for up to handleCapacity live handles. Slots come in chunks of kHandleChunkSlots allocated as the
+		//free slots run out, only the chunk directory is sized up front. Returns false if already enabled.
+		bool EnableHandleTable(uint32_t handleCapacity)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_handleChunks || handleCapacity == 0)
+				return false;
+
+			handleCapacity = (std::min)(handleCapacity, Handle::kIndexMask + 1);
+			m_handleChunks.reset(new std::atomic<HandleSlot*>[(handleCapacity + kHandleChunkSlots - 1) / kHandleChunkSlots]());
+			m_handleCapacity.store(handleCapacity, std::memory_order_release);
+			return true;
+		}
+
+		//Returns a null handle when the table is full or the allocation fails
+		Handle AllocateHandle(typename T_ALLOCATOR::Size memorySize, typename T_ALLOCATOR::Type memoryType)
+		{
+			uint32_t slotIdx = HandleSlot::kNoFreeSlot;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				slotIdx = PopFreeHandleSlot();
+				if (slotIdx == HandleSlot::kNoFreeSlot)
+					return Handle();
+				HandleSlotAt(slotIdx)->m_allocation.m_handleIdx = slotIdx;
+			}
+
+			HandleSlot& slot = *HandleSlotAt(slotIdx);
+			if (!AllocateInto(slot.m_allocation, memorySize, memoryType))
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				slot.m_allocation.Reset();
+				PushFreeHandleSlot(slotIdx);
+				return Handle();
+			}
+			return Handle(slotIdx, slot.m_generation.load(std::memory_order_relaxed));
+		}
+
+		//Returns kMemoryDefault for null or stale handles. The generation is 8 bits, so a stale handle is only caught until its slot has been
+		//reused 255 times. Slots are reused first in first out, so that takes 255 releases of every free slot, but code holding handles
+		//across longer stretches has to drop them on release rather than rely on the check.
+		//Takes no lock, it reads the generation and the block's memory as published by allocation, Compact and ReleaseHandle. The memory is
+		//only stable while the handle is pinned or nothing can release it or run Compact concurrently.
+		inline typename T_ALLOCATOR::Memory Resolve(Handle handle) const
+		{
+			const HandleSlot* slot = HandleSlotAt(handle.Index());
+			if (!slot || slot->m_generation.load(std::memory_order_acquire) != handle.Generation())
+				return T_ALLOCATOR::kMemoryDefault;
+			return slot->m_platformMemory.load(std::memory_order_acquire);
+		}
+
+		//Returns false for null or stale handles
+		bool ReleaseHandle(Handle handle)
+		{
+			const uint64_t startNs = m_latency.ShouldSample() ? LatencyRecorder::NowNs() : 0;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			LocalAllocation* allocation = FindHandleAllocation(handle);
+			if (!allocation)
+				return false;
+
+			HandleSlot& slot = *HandleSlotAt(handle.Index());
+			const size_t classIdx = ClassOf(slot.m_allocation);
+			ReleaseLocked(slot.m_allocation);
+			if (startNs)
+				m_latency.Record(classIdx, LatencyEvent::Free, startNs);
+			slot.m_allocation.Reset();
+			slot.m_platformMemory.store(T_ALLOCATOR::kMemoryDefault, std::memory_order_release);
+			slot.m_generation.store(Handle::NextGeneration(slot.m_generation.load(std::memory_order_relaxed)), std::memory_order_release);
+			PushFreeHandleSlot(handle.Index());
+			return true;
+		}
+
+		//Hard limit on platform memory held by pools and large allocations, 0 is unlimited
+		void SetMemoryBudget(size_t budgetBytes)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_budgetBytes = budgetBytes;
+		}
+		size_t GetMemoryBudget() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_budgetBytes;
+		}
+		size_t GetCommittedBytes() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_committedBytes;
+		}
+		//One entry per size class
+		std::vector<ClassMetadataOverhead> GetMetadataOverhead() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			std::vector<ClassMetadataOverhead> overhead;
+			overhead.reserve(m_poolLists.size());
+			for (const auto& poolList : m_poolLists)
+				overhead.push_back(poolList.MetadataOverhead());
+			return overhead;
+		}
+
+		//Latency recording is off until enabled, the histograms are allocated on first enable and kept until the allocator is destroyed
+		void SetLatencyPolicy(const LatencyPolicy& latencyPolicy)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_latency.SetPolicy(m_sizeClasses.Count(), latencyPolicy);
+		}
+		void ResetLatency()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_latency.Reset();
+		}
+
+		//Sampling starts with the next allocation, samples already taken stay in the profile until their blocks are freed
+		void SetHeapProfilePolicy(const HeapProfilePolicy& heapProfilePolicy) { m_heapProfiler.SetPolicy(heapProfilePolicy); }
+
+		//Sampled allocations still live, see HeapProfileFormat. Safe to call while other threads allocate.
+		template<typename T>
+		void WriteHeapProfile(T& output, HeapProfileFormat format) const
+		{
+			m_heapProfiler.Write(output, format);
+		}
+
+		//Records the requested size of pool blocks allocated from now on so AnalyzeFragmentation can report the space lost inside them,
+		//costs 4 bytes a block in every pool that hands out a block while tracking
+		void TrackRequestedBytes(bool bTrack)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_bTrackRequestedBytes = bTrack;
+		}
+
+		//Walks the block states of every pool. The lock is taken one class at a time, so classes are each consistent but
+		//not with each other. Compaction candidates are predicted for Compact(classIdx, sparseOccupancy).
+		FragmentationReport AnalyzeFragmentation(float sparseOccupancy = 0.5f) const
+		{
+			FragmentationReport report;
+			report.m_classes.resize(m_poolLists.size());
+			for (size_t classIdx = 0; classIdx < m_poolLists.size(); classIdx++)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_poolLists[classIdx].AnalyzeFragmentation(report.m_classes[classIdx], sparseOccupancy);
+			}
+			std::lock_guard<std::mutex> lock(m_mutex);
+			report.m_committedBytes = m_committedBytes;
+			report.m_largeAllocationBytes = m_largeAllocationBytes;
+			return report;
+		}
+
+		AllocatorStats GetStatsSnapshot() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			AllocatorStats stats;
+			stats.m_committedBytes = m_committedBytes;
+			stats.m_budgetBytes = m_budgetBytes;
+			stats.m_largeAllocationBytes = m_largeAllocationBytes;
+			stats.m_classes.resize(m_poolLists.size() + 1);
+			for (size_t classIdx = 0; classIdx < stats.m_classes.size(); classIdx++)
+			{
+				ClassStats& classStats = stats.m_classes[classIdx];
+				if (classIdx < m_poolLists.size())
+				{
+					classStats.m_blockSize = m_poolLists[classIdx].kBlockSize;
+					classStats.m_poolCount = m_poolLists[classIdx].m_directory.Count();
+					classStats.m_blockCount = m_poolLists[classIdx].m_totalBlockCount;
+				}
+				for (size_t eventIdx = 0; eventIdx < kLatencyEventCount; eventIdx++)
+					classStats.m_latency[eventIdx] = m_latency.Summarize(classIdx, static_cast<LatencyEvent>(eventIdx));
+			}
+			return stats;
+		}
+
+		//Called without the allocator lock held when the budget would be exceeded, callbacks may release Memory handles
+		CallbackId RegisterLowMemoryCallback(LowMemoryCallback callback)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_lowMemoryCallbacks.emplace_back(m_nextCallbackId, std::move(callback));
+			return m_nextCallbackId++;
+		}
+		void UnregisterLowMemoryCallback(CallbackId callbackId)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_lowMemoryCallbacks.erase(std::remove_if(m_lowMemoryCallbacks.begin(), m_lowMemoryCallbacks.end(), [callbackId](const auto& entry) { return entry.first == callbackId; }), m_lowMemoryCallbacks.end());
+		}
+
+		//m_platformMemory is only stable while pinned if Compact can run on another thread
+		typename T_ALLOCATOR::Memory Pin(const Memory& memory)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			memory->m_pinCount++;
+			return memory->m_platformMemory;
+		}
+		void Unpin(const Memory& memory)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			memory->m_pinCount--;
+		}
+
+		typename T_ALLOCATOR::Memory Pin(Handle handle)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			LocalAllocation* allocation = FindHandleAllocation(handle);
+			if (!allocation)
+				return T_ALLOCATOR::kMemoryDefault;
+			allocation->m_pinCount++;
+			return allocation->m_platformMemory;
+		}
+		void Unpin(Handle handle)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (LocalAllocation* allocation = FindHandleAllocation(handle))
+				allocation->m_pinCount--;
+		}
+
+		class ScopedPin
+		{
+		public:
+			ScopedPin(MemoryAllocator& allocator, const Memory& memory) : m_allocator(allocator), m_memory(memory), m_platformMemory(allocator.Pin(memory)) { }
+			~ScopedPin() { m_allocator.Unpin(m_memory); }
+			ScopedPin(const ScopedPin&) = delete;
+			ScopedPin& operator=(const ScopedPin&) = delete;
+
+			inline typename T_ALLOCATOR::Memory Get() const { return m_platformMemory; }
+		private:
+			MemoryAllocator& m_allocator;
+			Memory m_memory;
+			typename T_ALLOCATOR::Memory m_platformMemory;
+		};
+
+		//Moves live unpinned blocks out of pools at or below sparseOccupancy into the densest pools of the class, then releases the pools left empty.
+		//Without T_ALLOCATOR::Copy nothing moves and only empty pools are released. Returns the bytes released back to T_ALLOCATOR.
+		size_t Compact(size_t classIdx, float sparseOccupancy = 0.5f)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (classIdx >= m_poolLists.size())
+				return 0;
+			const size_t releasedBytes = m_poolLists[classIdx].Compact(sparseOccupancy);
+			m_committedBytes -= releasedBytes;
+			return releasedBytes;
+		}
+
+		//Returns pools with no live allocations to T_ALLOCATOR, returns the bytes released
+		size_t TrimEmptyPools()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return TrimEmptyPoolsLocked();
+		}
+
+		//Captures every pool with its free list and block types. whileLocked runs with the allocator locked so the platform allocator
+		//can capture its own state consistently with the pools. Waits for any decay Tick so no pool is out for purging.
+		void ExportPools(PersistedHeap<typename T_ALLOCATOR::Memory>& heap, const std::function<void()>& whileLocked = {})
+		{
+			std::lock_guard<std::mutex> tickLock(m_tickMutex);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			heap.m_pools.clear();
+			heap.m_largeAllocations.clear();
+			for (auto& poolList : m_poolLists)
+				poolList.ExportPools(heap.m_pools);
+			for (auto& large : m_largeRawAllocations)
+				heap.m_largeAllocations.emplace_back(large.first, large.second);
+			if (whileLocked)
+				whileLocked();
+		}
+
+		//Adopts pools exported by a previous process over the same platform memory. Only valid before the first allocation,
+		//returns false without importing anything when a pool doesn't match this allocator's classes or is inconsistent.
+		bool ImportPools(const PersistedHeap<typename T_ALLOCATOR::Memory>& heap)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (auto& poolList : m_poolLists)
+			{
+				if (poolList.m_directory.Count() != 0)
+					return false;
+			}
+
+			std::vector<size_t> classIndices;
+			for (auto& pool : heap.m_pools)
+			{
+				const size_t classIdx = m_sizeClasses.ClassIndexForSize(static_cast<size_t>(pool.m_blockSize));
+				if (classIdx == SizeClassTable::kInvalidClass || !m_poolLists[classIdx].CanImport(pool))
+					return false;
+				classIndices.push_back(classIdx);
+			}
+
+			for (size_t i = 0; i < heap.m_pools.size(); i++)
+			{
+				m_poolLists[classIndices[i]].ImportPool(heap.m_pools[i]);
+				m_committedBytes += static_cast<size_t>(heap.m_pools[i].m_poolBytes);
+			}
+			for (auto& large : heap.m_largeAllocations)
+			{
+				m_largeRawAllocations.emplace(large.first, static_cast<size_t>(large.second));
+				m_committedBytes += static_cast<size_t>(large.second);
+				m_largeAllocationBytes += static_cast<size_t>(large.second);
+			}
+			return true;
+		}
+
+		const SizeClassTable& GetSizeClasses() const { return m_sizeClasses; }
+
+		//Only affects pools created after the call
+		void SetGrowthPolicy(const GrowthPolicy& growthPolicy)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_growthPolicy = growthPolicy;
+		}
+		GrowthPolicy GetGrowthPolicy() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_growthPolicy;
+		}
+
+		//Must be set before the first allocation as it changes the block stride of the affected classes. Returns false once pools exist.
+		bool SetThreadSlabPolicy(const ThreadSlabPolicy& threadSlabPolicy)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (auto& poolList : m_poolLists)
+			{
+				if (poolList.m_directory.Count() != 0)
+					return false;
+			}
+			m_threadSlabPolicy = threadSlabPolicy;
+			for (auto& poolList : m_poolLists)
+				poolList.SetThreadSlabPolicy(threadSlabPolicy);
+			return true;
+		}
+		const ThreadSlabPolicy& GetThreadSlabPolicy() const { return m_threadSlabPolicy; }
+
+		//Only affects pools created after the call. Returns false and keeps the current policy when enabling colouring on a backend with RequiresAlignedBlocks.
+		bool SetColoringPolicy(const ColoringPolicy& coloringPolicy)
+		{
+			if (RequiresAlignedBlocks<T_ALLOCATOR>::value && coloringPolicy.m_bEnabled)
+				return false;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_coloringPolicy = coloringPolicy;
+			return true;
+		}
+		ColoringPolicy GetColoringPolicy() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_coloringPolicy;
+		}
+
+		void SetBorrowPolicy(const BorrowPolicy& borrowPolicy)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_borrowPolicy = borrowPolicy;
+		}
+		BorrowPolicy GetBorrowPolicy() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_borrowPolicy;
+		}
+
+		template<typename T>
+		void DebugPrint(T& dbgPrint, bool bOnlyPrintActivePools)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			dbgPrint << "Memory Allocator Info:" << "\n";
+			dbgPrint << "Committed:" << m_committedBytes << " Budget:" << m_budgetBytes << " Large:" << m_largeAllocationBytes << "\n";
+			for (size_t i = 0; i < m_poolLists.size(); i++)
+				m_poolLists[i].DebugPrint(i + 1, dbgPrint, bOnlyPrintActivePools);
+		}
+
+	private:
+		static SizeClassTable AlignedSizeClasses(SizeClassTable sizeClasses)
+		{
+			if constexpr (RequiresAlignedBlocks<T_ALLOCATOR>::value)
+			{
+				if (!sizeClasses.IsAlignedTo(T_ALLOCATOR::kAlignment))
+					return SizeClassTable(T_ALLOCATOR::kPoolSizes);
+			}
+			return sizeClasses;
+		}
+
+		static SizeClassTable DefaultSizeClasses()
+		{
+			if constexpr (UsesEnvironmentSizeClasses<T_ALLOCATOR>::value)
+				return SizeClassTable::LoadOrDefault(T_ALLOCATOR::kPoolSizes, T_ALLOCATOR::kAlignment);
+			else
+				return SizeClassTable(T_ALLOCATOR::kPoolSizes);
+		}
+
+		static constexpr uint32_t kHandleChunkSlots = 1024;
+
+		struct HandleSlot
+		{
+			static constexpr uint32_t kNoFreeSlot = ~0u;
+
+			LocalAllocation m_allocation;
+			std::atomic<typename T_ALLOCATOR::Memory> m_platformMemory{ T_ALLOCATOR::kMemoryDefault };		//Copy of m_allocation's for Resolve
+			std::atomic<uint32_t> m_generation{ 1 };
+			uint32_t m_nextFree = kNoFreeSlot;
+		};
+
+		//Under m_mutex whenever a handle's block is placed or moved
+		inline void PublishHandleMemory(const LocalAllocation& allocation)
+		{
+			if (allocation.m_handleIdx != LocalAllocation::kNoHandle)
+				HandleSlotAt(allocation.m_handleIdx)->m_platformMemory.store(allocation.m_platformMemory, std::memory_order_release);
+		}
+
+		//Fills allocation and sets its owner on success, otherwise only m_error is set
+		bool AllocateInto(LocalAllocation& allocation, typename T_ALLOCATOR::Size memorySize, typename T_ALLOCATOR::Type memoryType)
+		{
+			if (!AllocateBlock(allocation, memorySize, memoryType))
+				return false;
+			if (m_heapProfiler.IsEnabled())
+			{
+				const size_t blockBytes = allocation.m_largeAllocationSize ? allocation.m_largeAllocationSize : m_poolLists[ClassOf(allocation)].kBlockSize;
+				if (m_heapProfiler.ShouldSample(blockBytes))
+					m_heapProfiler.Record(ProbeAddress(allocation.m_platformMemory), memorySize, blockBytes, 1);
+			}
+			return true;
+		}
+
+		bool AllocateBlock(LocalAllocation& allocation, typename T_ALLOCATOR::Size memorySize, typename T_ALLOCATOR::Type memoryType)
+		{
+			const size_t classIdx = m_sizeClasses.ClassIndexForSize(memorySize);
+			const bool bSampled = m_latency.ShouldSample();
+			LatencyScope allocateTimer(m_latency, classIdx, LatencyEvent::Allocate, bSampled);
+			if (classIdx == SizeClassTable::kInvalidClass)
+			{
+				if (memorySize > T_ALLOCATOR::kMaxAllocationSize)
+					return Fail(allocation, AllocationError::TooLarge);
+				return AllocateLarge(allocation, memorySize);
+			}
+
+			const uint64_t slabOwner = CurrentSlabOwner();
+			std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+			{
+				LatencyScope lockTimer(m_latency, classIdx, LatencyEvent::LockWait, bSampled);
+				lock.lock();
+			}
+			auto& poolList = m_poolLists[classIdx];
+			if (poolList.TryAllocate(allocation, memoryType, slabOwner))
+				return Adopt(allocation, memorySize);
+
+			const size_t plannedBlockCount = poolList.PlannedPoolBlockCount(m_growthPolicy);
+			if (TryBorrow(allocation, classIdx, memorySize, memoryType, plannedBlockCount * poolList.m_blockStride, slabOwner))
+				return Adopt(allocation, memorySize);
+
+			const size_t colorOffset = poolList.NextColorOffset(m_coloringPolicy);
+			const size_t overheadBytes = poolList.PoolOverheadBytes(colorOffset);
+			const size_t blockCount = AcquireBudget(lock, classIdx, poolList.m_blockStride, plannedBlockCount, overheadBytes);
+			if (blockCount == 0)
+			{
+				//Callbacks may have released blocks in this class while the lock was dropped
+				if (poolList.TryAllocate(allocation, memoryType, slabOwner))
+					return Adopt(allocation, memorySize);
+				return Fail(allocation, AllocationError::OutOfBudget);
+			}
+
+			bool bAdded = false;
+			{
+				LatencyScope addPoolTimer(m_latency, classIdx, LatencyEvent::AddPool, m_latency.IsEnabled());
+				bAdded = poolList.AllocateFromNewPool(allocation, memoryType, m_growthPolicy, blockCount, colorOffset, slabOwner);
+			}
+			if (!bAdded)
+			{
+				m_committedBytes -= blockCount * poolList.m_blockStride + overheadBytes;
+				return Fail(allocation, AllocationError::PlatformFailure);
+			}
+			return Adopt(allocation, memorySize);
+		}
+
+		inline bool Adopt(LocalAllocation& allocation, typename T_ALLOCATOR::Size memorySize)
+		{
+			MEMORY_ALLOCATOR_PROBE(allocate, memorySize, ClassOf(allocation), allocation.m_platformMemory);
+			if (m_bTrackRequestedBytes && allocation.m_poolAllocatedFrom)
+				static_cast<typename PoolList::Pool*>(allocation.m_poolAllocatedFrom)->SetRequestedBytes(allocation.blockIdx, memorySize);
+			allocation.m_owner = this;
+			PublishHandleMemory(allocation);
+			return true;
+		}
+
+		inline bool Fail(LocalAllocation& allocation, AllocationError error)
+		{
+			allocation.m_error = error;
+			return false;
+		}
+
+		bool AllocateLarge(LocalAllocation& allocation, typename T_ALLOCATOR::Size memorySize)
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (AcquireBudget(lock, SizeClassTable::kInvalidClass, memorySize, 1) == 0)
+				return Fail(allocation, AllocationError::OutOfBudget);
+
+			{
+				LatencyScope platformTimer(m_latency, SizeClassTable::kInvalidClass, LatencyEvent::PlatformAllocate, m_latency.IsEnabled());
+				allocation.m_platformMemory = m_allocator.Allocate(memorySize, T_ALLOCATOR::kAlignment);
+			}
+			if (allocation.m_platformMemory == T_ALLOCATOR::kMemoryDefault)
+			{
+				m_committedBytes -= memorySize;
+				return Fail(allocation, AllocationError::PlatformFailure);
+			}
+			allocation.m_largeAllocationSize = memorySize;
+			allocation.m_bZeroed = IsZeroed(allocation.m_platformMemory, memorySize);
+			m_largeAllocationBytes += memorySize;
+			if (allocation.m_bRaw)
+				m_largeRawAllocations.emplace(allocation.m_platformMemory, memorySize);
+			return Adopt(allocation, memorySize);
+		}
+
+		void FreeRawLocked(typename T_ALLOCATOR::Memory platformMemory)
+		{
+			auto large = m_largeRawAllocations.find(platformMemory);
+			if (large != m_largeRawAllocations.end())
+			{
+				MEMORY_ALLOCATOR_PROBE(free, large->second, SizeClassTable::kInvalidClass, platformMemory);
+				m_heapProfiler.Forget(ProbeAddress(platformMemory));
+				FreeLarge(platformMemory, large->second);
+				m_committedBytes -= large->second;
+				m_largeAllocationBytes -= large->second;
+				m_largeRawAllocations.erase(large);
+				return;
+			}
+			for (auto& poolList : m_poolLists)
+			{
+				if (poolList.FreeRaw(platformMemory))
+					return;
+			}
+		}
+
+		struct DecayWork
+		{
+			static constexpr size_t kWholePool = ~size_t(0);
+
+			size_t m_classIdx = 0;
+			std::shared_ptr<PoolBase> m_pool;
+			size_t m_blockIdx = kWholePool;
+			typename T_ALLOCATOR::Memory m_platformMemory = T_ALLOCATOR::kMemoryDefault;
+			size_t m_size = 0;
+			PurgeMode m_purgeMode = PurgeMode::Lazy;
+			bool m_bRelease = false;
+		};
+
+		//Unique per thread and never reused, 0 means a pool isn't owned by any thread
+		static uint64_t CurrentSlabOwner()
+		{
+			static std::atomic<uint64_t> s_nextSlabOwner{ 1 };
+			thread_local const uint64_t t_slabOwner = s_nextSlabOwner.fetch_add(1, std::memory_order_relaxed);
+			return t_slabOwner;
+		}
+
+		//PurgeMode::Now decommits when T_ALLOCATOR can, FinishDecayWork marks the range for committing again on reuse
+		inline void Purge(typename T_ALLOCATOR::Memory platformMemory, size_t memorySize, PurgeMode purgeMode)
+		{
+			if constexpr (kUsesDecommit<T_ALLOCATOR>)
+			{
+				if (purgeMode == PurgeMode::Now)
+				{
+					m_allocator.Decommit(platformMemory, memorySize);
+					return;
+				}
+			}
+			if constexpr (HasPurge<T_ALLOCATOR>::value)
+				m_allocator.Purge(platformMemory, memorySize, purgeMode);
+		}
+
+		inline bool IsZeroed(typename T_ALLOCATOR::Memory platformMemory, size_t memorySize)
+		{
+			if constexpr (HasIsZeroed<T_ALLOCATOR>::value)
+				return m_allocator.IsZeroed(platformMemory, memorySize);
+			return false;
+		}
+
+		//Null past the capacity and for slots whose chunk hasn't been allocated yet
+		inline HandleSlot* HandleSlotAt(uint32_t slotIdx) const
+		{
+			if (slotIdx >= m_handleCapacity.load(std::memory_order_acquire))
+				return nullptr;
+			HandleSlot* chunk = m_handleChunks[slotIdx / kHandleChunkSlots].load(std::memory_order_acquire);
+			return chunk ? &chunk[slotIdx % kHandleChunkSlots] : nullptr;
+		}
+
+		inline LocalAllocation* FindHandleAllocation(Handle handle)
+		{
+			HandleSlot* slot = HandleSlotAt(handle.Index());
+			if (!slot || slot->m_generation.load(std::memory_order_relaxed) != handle.Generation() || !slot->m_allocation.m_owner)
+				return nullptr;
+			return &slot->m_allocation;
+		}
+
+		//Adds the next chunk of slots to the free list, false once the table is at capacity
+		bool GrowHandleTable()
+		{
+			const uint32_t handleCapacity = m_handleCapacity.load(std::memory_order_relaxed);
+			if (m_handleSlotCount >= handleCapacity)
+				return false;
+			const uint32_t firstSlotIdx = m_handleSlotCount;
+			const uint32_t slotCount = (std::min)(kHandleChunkSlots, handleCapacity - firstSlotIdx);
+			HandleSlot* chunk = new (std::nothrow) HandleSlot[slotCount];
+			if (!chunk)
+				return false;
+			m_handleChunks[firstSlotIdx / kHandleChunkSlots].store(chunk, std::memory_order_release);
+			m_handleSlotCount += slotCount;
+			for (uint32_t slotIdx = firstSlotIdx; slotIdx < firstSlotIdx + slotCount; slotIdx++)
+				PushFreeHandleSlot(slotIdx);
+			return true;
+		}
+
+		inline uint32_t PopFreeHandleSlot()
+		{
+			if (m_firstFreeHandle == HandleSlot::kNoFreeSlot && !GrowHandleTable())
+				return HandleSlot::kNoFreeSlot;
+			const uint32_t slotIdx = m_firstFreeHandle;
+			m_firstFreeHandle = HandleSlotAt(slotIdx)->m_nextFree;
+			if (m_firstFreeHandle == HandleSlot::kNoFreeSlot)
+				m_lastFreeHandle = HandleSlot::kNoFreeSlot;
+			return slotIdx;
+		}
+
+		//Slots are reused first in first out so a generation takes as long as possible to come round again
+		inline void PushFreeHandleSlot(uint32_t slotIdx)
+		{
+			HandleSlotAt(slotIdx)->m_nextFree = HandleSlot::kNoFreeSlot;
+			if (m_lastFreeHandle == HandleSlot::kNoFreeSlot)
+				m_firstFreeHandle = slotIdx;
+			else
+				HandleSlotAt(m_lastFreeHandle)->m_nextFree = slotIdx;
+			m_lastFreeHandle = slotIdx;
+		}
+
+		void Release(LocalAllocation& allocation)
+		{
+			LatencyScope freeTimer(m_latency, ClassOf(allocation), LatencyEvent::Free, m_latency.ShouldSample());
+			std::lock_guard<std::mutex> lock(m_mutex);
+			ReleaseLocked(allocation);
+		}
+
+		void ReleaseBufferBlock(PoolBase& pool, size_t blockIdx)
+		{
+			auto& classPool = static_cast<typename PoolList::Pool&>(pool);
+			LatencyScope freeTimer(m_latency, classPool.m_classIdx, LatencyEvent::Free, m_latency.ShouldSample());
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const PoolList& poolList = m_poolLists[classPool.m_classIdx];
+			const auto blockMemory = m_allocator.Offset(classPool.m_platformMemory, classPool.m_colorOffset + blockIdx * poolList.m_blockStride);
+			MEMORY_ALLOCATOR_PROBE(free, poolList.kBlockSize, classPool.m_classIdx, blockMemory);
+			m_heapProfiler.Forget(ProbeAddress(blockMemory));
+			pool.Deallocate(blockIdx);
+		}
+
+		inline void FreeLarge(typename T_ALLOCATOR::Memory platformMemory, size_t memorySize)
+		{
+			LatencyScope platformTimer(m_latency, SizeClassTable::kInvalidClass, LatencyEvent::PlatformFree, m_latency.IsEnabled());
+			m_allocator.Free(platformMemory, memorySize);
+		}
+
+		inline size_t ClassOf(const LocalAllocation& allocation) const
+		{
+			return allocation.m_poolAllocatedFrom ? static_cast<const typename PoolList::Pool*>(allocation.m_poolAllocatedFrom)->m_classIdx : SizeClassTable::kInvalidClass;
+		}
+
+		void ReleaseLocked(LocalAllocation& allocation)
+		{
+			if (allocation.m_poolAllocatedFrom)
+			{
+				MEMORY_ALLOCATOR_PROBE(free, m_poolLists[ClassOf(allocation)].kBlockSize, ClassOf(allocation), allocation.m_platformMemory);
+				m_heapProfiler.Forget(ProbeAddress(allocation.m_platformMemory));
+				allocation.m_poolAllocatedFrom->Deallocate(allocation.blockIdx);
+			}
+			else if (allocation.m_largeAllocationSize)
+			{
+				MEMORY_ALLOCATOR_PROBE(free, allocation.m_largeAllocationSize, SizeClassTable::kInvalidClass, allocation.m_platformMemory);
+				m_heapProfiler.Forget(ProbeAddress(allocation.m_platformMemory));
+				FreeLarge(allocation.m_platformMemory, allocation.m_largeAllocationSize);
+				m_committedBytes -= allocation.m_largeAllocationSize;
+				m_largeAllocationBytes -= allocation.m_largeAllocationSize;
+			}
+		}
+
+		//Commits up to desiredBlockCount blocks plus overheadBytes against the budget, trimming, shrinking the request and finally calling the
+		//low memory callbacks. Returns the number of blocks committed, 0 when not even a single block fits and nothing was committed.
+		size_t AcquireBudget(std::unique_lock<std::mutex>& lock, size_t classIdx, size_t blockSize, size_t desiredBlockCount, size_t overheadBytes = 0)
+		{
+			auto blocksThatFit = [&]() -> size_t
+			{
+				if (m_budgetBytes == 0)
+					return desiredBlockCount;
+				if (m_committedBytes + overheadBytes >= m_budgetBytes)
+					return 0;
+				return (std::min)(desiredBlockCount, (m_budgetBytes - m_committedBytes - overheadBytes) / blockSize);
+			};
+			auto commit = [&](size_t blockCount)
+			{
+				m_committedBytes += blockCount * blockSize + overheadBytes;
+				return blockCount;
+			};
+
+			if (blocksThatFit() == desiredBlockCount)
+				return commit(desiredBlockCount);
+			MEMORY_ALLOCATOR_PROBE(budget_hit, blockSize * desiredBlockCount + overheadBytes, classIdx, m_committedBytes);
+
+			TrimEmptyPoolsLocked();
+			if (const size_t blockCount = blocksThatFit())
+				return commit(blockCount);
+
+			if (!m_lowMemoryCallbacks.empty())
+			{
+				auto callbacks = m_lowMemoryCallbacks;
+				lock.unlock();
+				for (auto& callback : callbacks)
+					callback.second(blockSize);
+				lock.lock();
+
+				TrimEmptyPoolsLocked();
+				if (const size_t blockCount = blocksThatFit())
+					return commit(blockCount);
+			}
+			return 0;
+		}
+
+		size_t TrimEmptyPoolsLocked()
+		{
+			size_t releasedBytes = 0;
+			for (auto& poolList : m_poolLists)
+				releasedBytes += poolList.ReleaseEmptyPools();
+			m_committedBytes -= releasedBytes;
+			return releasedBytes;
+		}
+
+		inline bool IsNearBudget(size_t growthBytes) const
+		{
+			return m_budgetBytes != 0 && static_cast<float>(m_committedBytes + growthBytes) > m_borrowPolicy.m_nearBudgetFraction * static_cast<float>(m_budgetBytes);
+		}
+
+		inline bool TryBorrow(LocalAllocation& allocation, size_t classIdx, typename T_ALLOCATOR::Size memorySize, typename T_ALLOCATOR::Type memoryType, size_t growthBytes, uint64_t slabOwner)
+		{
+			if (!m_borrowPolicy.m_bEnabled)
+				return false;
+			if (m_borrowPolicy.m_bOnlyNearBudget && !IsNearBudget(growthBytes))
+				return false;
+
+			const size_t lastClassIdx = (std::min)(m_poolLists.size() - 1, classIdx + m_borrowPolicy.m_maxClassesAhead);
+			for (size_t lenderIdx = classIdx + 1; lenderIdx <= lastClassIdx; lenderIdx++)
+			{
+				auto& lender = m_poolLists[lenderIdx];
+				if (!m_borrowPolicy.AcceptsBlock(memorySize, lender.kBlockSize))
+					break;
+				if (lender.TryAllocate(allocation, memoryType, slabOwner))
+				{
+					lender.m_lentTotal++;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		struct PoolList
+		{
+			struct Pool;
+			struct PoolDirectory;
+
+			PoolList(T_ALLOCATOR& platformAllocator, const PoolSizeConstructor& sizeClass, size_t classIdx, LatencyRecorder& latency, HeapProfiler& heapProfiler) : kSizeClass(sizeClass), kBlockSize(sizeClass.kPoolSize), kBlockCount(sizeClass.kPoolCount), m_platformAllocator(platformAllocator), m_latency(&latency), m_heapProfiler(&heapProfiler), m_classIdx(classIdx), m_blockStride(sizeClass.kPoolSize)
+			{
+
+			}
+
+			void SetThreadSlabPolicy(const ThreadSlabPolicy& threadSlabPolicy)
+			{
+				m_bThreadOwned = threadSlabPolicy.AppliesTo(kBlockSize);
+				m_blockStride = threadSlabPolicy.BlockStride(kBlockSize);
+				m_firstBlockAlignment = m_bThreadOwned ? threadSlabPolicy.m_cacheLineSize : 0;
+			}
+
+			//Returns false when every existing pool the caller may use is full
+			inline bool TryAllocate(LocalAllocation& allocation, typename T_ALLOCATOR::Type memoryType, uint64_t slabOwner)
+			{
+				//Pools of shared classes all have owner 0
+				const uint64_t owner = m_bThreadOwned ? slabOwner : 0;
+				for (size_t entryIdx = m_directory.FindWithRoom(0, owner); entryIdx != PoolDirectory::kNoEntry; entryIdx = m_directory.FindWithRoom(entryIdx + 1, owner))
+				{
+					Pool& pool = m_directory.Header(entryIdx);
+					bool bZeroed = false;
+					auto blockIdx = TakeBlock(pool, memoryType, bZeroed);
+					if (blockIdx)
+					{
+						AssignBlock(allocation, pool, *blockIdx, bZeroed);
+						return true;
+					}
+				}
+
+				//An empty pool holds nothing another thread is writing to, so it can change hands
+				if (m_bThreadOwned)
+				{
+					for (size_t entryIdx = m_directory.FindEmpty(0); entryIdx != PoolDirectory::kNoEntry; entryIdx = m_directory.FindEmpty(entryIdx + 1))
+					{
+						Pool& pool = m_directory.Header(entryIdx);
+						bool bZeroed = false;
+						auto blockIdx = TakeBlock(pool, memoryType, bZeroed);
+						if (!blockIdx)
+							continue;
+						m_directory.SetSlabOwner(entryIdx, slabOwner);
+						AssignBlock(allocation, pool, *blockIdx, bZeroed);
+						return true;
+					}
+				}
+				return false;
+			}
+
+			inline size_t NextColorOffset(const ColoringPolicy& coloringPolicy) const
+			{
+				return (m_nextColor % coloringPolicy.ColorCount(kBlockSize)) * coloringPolicy.m_cacheLineSize;
+			}
+
+			inline size_t PlannedPoolBlockCount(const GrowthPolicy& growthPolicy) const
+			{
+				return m_nextPoolBlockCount ? m_nextPoolBlockCount : growthPolicy.FirstPoolBlockCount(kSizeClass);
+			}
+
+			//Bytes a new pool takes on top of its blocks, always PoolOverheadBytes(colorOffset) past blockCount * m_blockStride
+			inline size_t PoolOverheadBytes(size_t colorOffset) const { return colorOffset + AlignmentSlack(); }
+
+			//Room to slide the first block up to m_firstBlockAlignment, platform allocators aren't required to honour the alignment they're passed
+			inline size_t AlignmentSlack() const { return std::is_pointer<typename T_ALLOCATOR::Memory>::value ? m_firstBlockAlignment : 0; }
+
+			//blockCount may be lower than PlannedPoolBlockCount when the memory budget is tight. Returns false if the platform allocation fails.
+			inline bool AllocateFromNewPool(LocalAllocation& allocation, typename T_ALLOCATOR::Type memoryType, const GrowthPolicy& growthPolicy, size_t blockCount, size_t colorOffset, uint64_t slabOwner)
+			{
+				Pool* newPool = AddNewPool(growthPolicy, blockCount, colorOffset);
+				if (!newPool)
+					return false;
+				m_directory.SetSlabOwner(newPool->m_directoryIdx, m_bThreadOwned ? slabOwner : 0);
+
+				bool bZeroed = false;
+				auto blockIdx = TakeBlock(*newPool, memoryType, bZeroed);
+				if (!blockIdx)
+				{
+					ReleasePool(*newPool);
+					m_directory.Erase(newPool->m_directoryIdx);
+					return false;
+				}
+				AssignBlock(allocation, *newPool, *blockIdx, bZeroed);
+				return true;
+			}
+
+			//Returns false when platformMemory isn't a block of this class
+			inline bool FreeRaw(typename T_ALLOCATOR::Memory platformMemory)
+			{
+				auto next = std::upper_bound(m_poolsByAddress.begin(), m_poolsByAddress.end(), platformMemory, [](typename T_ALLOCATOR::Memory memory, const Pool* pool) { return std::less<typename T_ALLOCATOR::Memory>()(memory, pool->m_platformMemory); });
+				if (next == m_poolsByAddress.begin())
+					return false;
+
+				Pool& pool = **(next - 1);
+				const size_t offset = m_platformAllocator.Distance(pool.m_platformMemory, platformMemory);
+				if (offset < pool.m_colorOffset || offset >= pool.m_colorOffset + pool.BlockCount() * m_blockStride)
+					return false;
+				//A block that is already free is ignored rather than pushed onto the free list twice
+				const size_t blockIdx = (offset - pool.m_colorOffset) / m_blockStride;
+				if (pool.IsAllocated(blockIdx))
+				{
+					MEMORY_ALLOCATOR_PROBE(free, kBlockSize, m_classIdx, platformMemory);
+					m_heapProfiler->Forget(ProbeAddress(platformMemory));
+					pool.Deallocate(blockIdx);
+				}
+				return true;
+			}
+
+			//Returns the bytes released
+			size_t ReleaseEmptyPools()
+			{
+				size_t releasedBytes = 0;
+				for (size_t entryIdx = m_directory.FindEmpty(0); entryIdx != PoolDirectory::kNoEntry; entryIdx = m_directory.FindEmpty(entryIdx))
+				{
+					releasedBytes += ReleasePool(m_directory.Header(entryIdx));
+					m_directory.Erase(entryIdx);
+				}
+				return releasedBytes;
+			}
+
+			size_t Compact(float sparseOccupancy)
+			{
+				if constexpr (!HasCopy<T_ALLOCATOR>::value)
+					return ReleaseEmptyPools();
+				if (m_directory.Count() < 2)
+					return 0;
+
+				//Blocks only move between pools of the same owning thread
+				std::vector<Pool*> byOwner = m_directory.Headers();
+				std::sort(byOwner.begin(), byOwner.end(), [](const Pool* a, const Pool* b) { return a->m_slabOwner < b->m_slabOwner; });
+				for (size_t groupBegin = 0; groupBegin < byOwner.size();)
+				{
+					size_t groupEnd = groupBegin + 1;
+					while (groupEnd < byOwner.size() && byOwner[groupEnd]->m_slabOwner == byOwner[groupBegin]->m_slabOwner)
+						groupEnd++;
+					CompactGroup(std::vector<Pool*>(byOwner.begin() + groupBegin, byOwner.begin() + groupEnd), sparseOccupancy);
+					groupBegin = groupEnd;
+				}
+				return ReleaseEmptyPools();
+			}
+
+			void CompactGroup(std::vector<Pool*> byOccupancy, float sparseOccupancy)
+			{
+				if (byOccupancy.size() < 2)
+					return;
+
+				//Densest first, sources are taken from the back and destinations from the front
+				std::sort(byOccupancy.begin(), byOccupancy.end(), [](const Pool* a, const Pool* b) { return a->Occupancy() > b->Occupancy(); });
+
+				size_t dst = 0;
+				for (size_t src = byOccupancy.size() - 1; src > dst; src--)
+				{
+					Pool& source = *byOccupancy[src];
+					if (source.Occupancy() > sparseOccupancy)
+						break;
+
+					for (size_t blockIdx = 0; blockIdx < source.BlockCount() && source.ActiveAllocationCount() > 0; blockIdx++)
+					{
+						LocalAllocation* owner = source.Owner(blockIdx);
+						if (!owner || owner->m_pinCount > 0)
+							continue;
+
+						while (dst < src && byOccupancy[dst]->IsFull())
+							dst++;
+						if (dst == src)
+							break;
+
+						if (!MoveBlock(source, blockIdx, *byOccupancy[dst]))
+							return;
+					}
+				}
+			}
+
+			//Stamps idle memory and moves whatever has been idle long enough out of reach of allocation into decayWork
+			void CollectDecayWork(size_t classIdx, uint64_t nowMs, const DecayPolicy& decayPolicy, bool bCanPurge, std::vector<DecayWork>& decayWork)
+			{
+				auto nextStage = [&](uint64_t idleSinceMs, uint8_t stage, bool bCanRelease) -> uint8_t
+				{
+					const uint64_t idleMs = nowMs - idleSinceMs;
+					if (bCanRelease && idleMs >= static_cast<uint64_t>(decayPolicy.m_releaseAfter.count()))
+						return Pool::kDecayReleased;
+					if (bCanPurge && stage < Pool::kDecayPurged && idleMs >= static_cast<uint64_t>(decayPolicy.m_purgeAfter.count()))
+						return Pool::kDecayPurged;
+					if (bCanPurge && stage < Pool::kDecayLazyPurged && idleMs >= static_cast<uint64_t>(decayPolicy.m_lazyPurgeAfter.count()))
+						return Pool::kDecayLazyPurged;
+					return stage;
+				};
+
+				const bool bPurgeBlocks = bCanPurge && kBlockSize >= decayPolicy.m_purgeGranularity;
+				for (size_t i = 0; i < m_directory.Count();)
+				{
+					Pool* pool = &m_directory.Header(i);
+					if (m_directory.IsEmpty(i))
+					{
+						if (pool->m_idleSinceMs == 0)
+						{
+							pool->m_idleSinceMs = nowMs;
+							i++;
+							continue;
+						}
+						const uint8_t stage = nextStage(pool->m_idleSinceMs, pool->m_decayStage, true);
+						if (stage == pool->m_decayStage)
+						{
+							i++;
+							continue;
+						}
+
+						DecayWork work;
+						work.m_classIdx = classIdx;
+						work.m_pool = m_directory.Owned(i);
+						work.m_platformMemory = pool->m_platformMemory;
+						work.m_size = pool->m_poolBytes;
+						work.m_bRelease = stage == Pool::kDecayReleased;
+						work.m_purgeMode = stage == Pool::kDecayPurged ? PurgeMode::Now : PurgeMode::Lazy;
+						if (work.m_bRelease)
+						{
+							m_totalBlockCount -= pool->BlockCount();
+							RemoveFromAddressIndex(*pool);
+						}
+						pool->m_decayStage = stage;
+						m_directory.Erase(i);
+						decayWork.push_back(std::move(work));
+						continue;
+					}
+
+					pool->m_idleSinceMs = 0;
+					if (bPurgeBlocks)
+					{
+						pool->EnableIdleStamps();
+						size_t keptCount = 0;
+						for (size_t freeIdx = 0; freeIdx < pool->m_freeList.size(); freeIdx++)
+						{
+							const size_t blockIdx = pool->m_freeList[freeIdx];
+							if (pool->m_blockIdleSinceMs[blockIdx] == 0)
+							{
+								pool->m_blockIdleSinceMs[blockIdx] = nowMs;
+								pool->m_freeList[keptCount++] = static_cast<uint32_t>(blockIdx);
+								continue;
+							}
+							const uint8_t stage = nextStage(pool->m_blockIdleSinceMs[blockIdx], pool->DecayStage(blockIdx), false);
+							if (stage == pool->DecayStage(blockIdx))
+							{
+								pool->m_freeList[keptCount++] = static_cast<uint32_t>(blockIdx);
+								continue;
+							}
+
+							DecayWork work;
+							work.m_classIdx = classIdx;
+							work.m_pool = m_directory.Owned(i);
+							work.m_blockIdx = blockIdx;
+							work.m_platformMemory = BlockMemory(*pool, blockIdx);
+							work.m_size = kBlockSize;
+							work.m_purgeMode = stage == Pool::kDecayPurged ? PurgeMode::Now : PurgeMode::Lazy;
+							pool->SetDecayStage(blockIdx, stage);
+							pool->ReserveForDecay();
+							decayWork.push_back(std::move(work));
+						}
+						pool->m_freeList.resize(keptCount);
+					}
+					i++;
+				}
+			}
+
+			void DropIdleStamps()
+			{
+				for (auto& pool : m_directory.Pools())
+					pool->DropIdleStamps();
+			}
+
+			//Puts purged blocks and pools back where allocation can find them
+			void FinishDecayWork(const DecayWork& work)
+			{
+				auto pool = std::static_pointer_cast<Pool>(work.m_pool);
+				const bool bDecommitted = kUsesDecommit<T_ALLOCATOR> && work.m_purgeMode == PurgeMode::Now;
+				if (work.m_blockIdx == DecayWork::kWholePool)
+				{
+					if (bDecommitted)
+						pool->m_commitWatermark = 0;
+					m_directory.Add(pool);
+				}
+				else
+				{
+					if (bDecommitted)
+						pool->MarkDecommitted(work.m_blockIdx);
+					pool->ReturnFromDecay(work.m_blockIdx);
+				}
+			}
+
+			void ExportPools(std::vector<PersistedPool<typename T_ALLOCATOR::Memory>>& pools) const
+			{
+				for (auto& pool : m_directory.Pools())
+				{
+					PersistedPool<typename T_ALLOCATOR::Memory> persisted;
+					persisted.m_blockSize = kBlockSize;
+					persisted.m_blockStride = m_blockStride;
+					persisted.m_poolBytes = pool->m_poolBytes;
+					persisted.m_colorOffset = pool->m_colorOffset;
+					persisted.m_memory = pool->m_platformMemory;
+					persisted.m_types.reserve(pool->BlockCount());
+					for (size_t blockIdx = 0; blockIdx < pool->BlockCount(); blockIdx++)
+						persisted.m_types.push_back(pool->IsAllocated(blockIdx) ? static_cast<uint32_t>(pool->BlockType(blockIdx)) : 0);
+					persisted.m_freeBlocks.assign(pool->m_freeList.rbegin(), pool->m_freeList.rend());
+					for (size_t blockIdx = pool->BumpWatermark(); blockIdx < pool->BlockCount(); blockIdx++)
+						persisted.m_freeBlocks.push_back(static_cast<uint32_t>(blockIdx));
+					pools.push_back(std::move(persisted));
+				}
+			}
+
+			inline bool CanImport(const PersistedPool<typename T_ALLOCATOR::Memory>& pool) const
+			{
+				const size_t blockCount = pool.m_types.size();
+				if (pool.m_blockSize != kBlockSize || pool.m_blockStride != m_blockStride || blockCount == 0 || pool.m_freeBlocks.size() > blockCount)
+					return false;
+				if (pool.m_colorOffset + blockCount * m_blockStride > pool.m_poolBytes)
+					return false;
+				std::vector<bool> bFree(blockCount, false);
+				for (auto blockIdx : pool.m_freeBlocks)
+				{
+					if (blockIdx >= blockCount || bFree[blockIdx])
+						return false;
+					bFree[blockIdx] = true;
+				}
+				return true;
+			}
+
+			void ImportPool(const PersistedPool<typename T_ALLOCATOR::Memory>& persisted)
+			{
+				const size_t blockCount = persisted.m_types.size();
+				auto pool = Pool::Create(blockCount);
+				pool->m_classIdx = m_classIdx;
+				pool->m_platformMemory = persisted.m_memory;
+				pool->m_poolBytes = static_cast<size_t>(persisted.m_poolBytes);
+				pool->m_colorOffset = static_cast<size_t>(persisted.m_colorOffset);
+				pool->m_commitWatermark = pool->m_poolBytes;
+				pool->Restore(persisted.m_types, persisted.m_freeBlocks);
+				m_directory.Add(pool);
+				m_poolsByAddress.insert(std::upper_bound(m_poolsByAddress.begin(), m_poolsByAddress.end(), pool.get(), PoolAddressLess), pool.get());
+				m_totalBlockCount += blockCount;
+				m_nextPoolBlockCount = (std::max)(m_nextPoolBlockCount, blockCount);
+			}
+
+			void AnalyzeFragmentation(ClassFragmentation& fragmentation, float sparseOccupancy) const
+			{
+				fragmentation.m_blockSize = kBlockSize;
+				fragmentation.m_pools.resize(m_directory.Count());
+				for (size_t entryIdx = 0; entryIdx < m_directory.Count(); entryIdx++)
+				{
+					const Pool& pool = *m_directory.Headers()[entryIdx];
+					PoolOccupancy& occupancy = fragmentation.m_pools[entryIdx];
+					occupancy.m_poolBytes = pool.m_poolBytes;
+					occupancy.m_blockCount = pool.BlockCount();
+					occupancy.m_untouchedCount = pool.UntouchedBlockCount();
+					occupancy.m_slabOwner = pool.m_slabOwner;
+
+					size_t freeRun = 0;
+					auto endRun = [&]()
+					{
+						if (freeRun == 0)
+							return;
+						size_t bucket = 0;
+						while ((freeRun >> (bucket + 1)) != 0 && bucket + 1 < ClassFragmentation::kRunBuckets)
+							bucket++;
+						fragmentation.m_freeRuns[bucket]++;
+						occupancy.m_longestFreeRun = (std::max)(occupancy.m_longestFreeRun, freeRun);
+						freeRun = 0;
+					};
+					for (size_t blockIdx = 0; blockIdx < pool.BlockCount(); blockIdx++)
+					{
+						if (!pool.IsAllocated(blockIdx))
+						{
+							freeRun++;
+							occupancy.m_decommittedCount += pool.IsDecommitted(blockIdx) ? 1 : 0;
+							continue;
+						}
+						endRun();
+						occupancy.m_allocatedCount++;
+						if (const size_t requestedBytes = pool.RequestedBytes(blockIdx))
+						{
+							occupancy.m_requestedBytes += requestedBytes;
+							fragmentation.m_requestedBytes += requestedBytes;
+							fragmentation.m_trackedCount++;
+						}
+					}
+					endRun();
+					occupancy.m_bReclaimable = occupancy.m_allocatedCount == 0;
+					fragmentation.m_allocatedCount += occupancy.m_allocatedCount;
+					fragmentation.m_freeCount += occupancy.m_blockCount - occupancy.m_allocatedCount;
+				}
+				if constexpr (HasCopy<T_ALLOCATOR>::value)
+					PredictCompaction(fragmentation.m_pools, sparseOccupancy);
+			}
+
+			//Replays CompactGroup's choice of sources and destinations against the free counts without moving anything
+			void PredictCompaction(std::vector<PoolOccupancy>& pools, float sparseOccupancy) const
+			{
+				std::vector<size_t> byOccupancy(pools.size());
+				for (size_t entryIdx = 0; entryIdx < pools.size(); entryIdx++)
+					byOccupancy[entryIdx] = entryIdx;
+				std::stable_sort(byOccupancy.begin(), byOccupancy.end(), [&](size_t a, size_t b)
+				{
+					if (pools[a].m_slabOwner != pools[b].m_slabOwner)
+						return pools[a].m_slabOwner < pools[b].m_slabOwner;
+					return pools[a].Occupancy() > pools[b].Occupancy();
+				});
+
+				for (size_t groupBegin = 0; groupBegin < byOccupancy.size();)
+				{
+					size_t groupEnd = groupBegin + 1;
+					while (groupEnd < byOccupancy.size() && pools[byOccupancy[groupEnd]].m_slabOwner == pools[byOccupancy[groupBegin]].m_slabOwner)
+						groupEnd++;
+
+					std::vector<size_t> room(groupEnd - groupBegin);
+					for (size_t i = 0; i < room.size(); i++)
+						room[i] = pools[byOccupancy[groupBegin + i]].m_blockCount - pools[byOccupancy[groupBegin + i]].m_allocatedCount;
+
+					size_t dst = 0;
+					for (size_t src = room.size() - 1; src > dst; src--)
+					{
+						PoolOccupancy& source = pools[byOccupancy[groupBegin + src]];
+						if (source.Occupancy() > sparseOccupancy)
+							break;
+						if (source.m_allocatedCount == 0)
+							continue;
+
+						const size_t movableCount = MovableCount(*m_directory.Headers()[byOccupancy[groupBegin + src]]);
+						size_t remaining = movableCount;
+						while (remaining && dst < src)
+						{
+							const size_t moved = (std::min)(remaining, room[dst]);
+							remaining -= moved;
+							room[dst] -= moved;
+							if (room[dst] == 0)
+								dst++;
+						}
+						source.m_bCompactable = remaining == 0 && movableCount == source.m_allocatedCount;
+					}
+					groupBegin = groupEnd;
+				}
+			}
+
+			//Live blocks with a handle to patch and no pin, the only ones Compact moves
+			static size_t MovableCount(const Pool& pool)
+			{
+				size_t movableCount = 0;
+				for (size_t blockIdx = 0; blockIdx < pool.BlockCount(); blockIdx++)
+				{
+					if (pool.IsAllocated(blockIdx) && pool.Owner(blockIdx) && pool.Owner(blockIdx)->m_pinCount == 0)
+						movableCount++;
+				}
+				return movableCount;
+			}
+
+			ClassMetadataOverhead MetadataOverhead() const
+			{
+				ClassMetadataOverhead overhead;
+				overhead.m_blockSize = kBlockSize;
+				overhead.m_poolCount = m_directory.Count();
+				overhead.m_blockCount = m_totalBlockCount;
+				overhead.m_metadataBytes = m_directory.MetadataBytes() + m_poolsByAddress.capacity() * sizeof(Pool*);
+				for (const auto& pool : m_directory.Pools())
+					overhead.m_metadataBytes += pool->MetadataBytes();
+				return overhead;
+			}
+
+			void ReleaseAllPools()
+			{
+				for (auto& pool : m_directory.Pools())
+					ReleasePool(*pool);
+				m_directory.Clear();
+			}
+
+			template<typename T>
+			inline void DebugPrint(size_t poolNumber, T& dbgPrint, bool bOnlyPrintActivePools)
+			{
+				if (!bOnlyPrintActivePools || (bOnlyPrintActivePools && m_directory.Count() > 0))
+				{
+					dbgPrint.precision(4);
+						dbgPrint << "#" << poolNumber << "  ";
+						dbgPrint << (size_t)kBlockSize;
+						dbgPrint << "(" << static_cast<float>(kBlockSize) / 1024.0f / 1024.0f << "mb)";
+						dbgPrint << "x";
+						dbgPrint << (size_t)kBlockCount;
+						dbgPrint << "=" << static_cast<size_t>(kBlockSize * kBlockCount);
+						dbgPrint << "(" << static_cast<float>(kBlockSize * kBlockCount) / 1024.0f / 1024.0f << "mb)";
+						dbgPrint << "\n";
+						dbgPrint << "Pool Count:" << m_directory.Count();
+						dbgPrint << " Blocks:" << m_totalBlockCount;
+						dbgPrint << " Next Pool Blocks:" << (m_nextPoolBlockCount ? m_nextPoolBlockCount : kBlockCount);
+						dbgPrint << " Lent total:" << m_lentTotal;
+						dbgPrint << " Metadata:" << MetadataOverhead().m_metadataBytes << "\n";
+				}
+			}
+
+			//Allocated with its packed block states straight after the header, see Create
+			struct Pool : public PoolBase
+			{
+				static constexpr uint8_t kDecayNone = 0;
+				static constexpr uint8_t kDecayLazyPurged = 1;
+				static constexpr uint8_t kDecayPurged = 2;
+				static constexpr uint8_t kDecayReleased = 3;
+
+				//Per block state, kStateBits a block. Allocated blocks hold their type below kStateAllocated, free blocks their decay stage and kStateDecommitted.
+				static constexpr size_t kStateBits = BlockStateBits<T_ALLOCATOR>::value;
+				static constexpr size_t kStatesPerByte = 8 / kStateBits;
+				static constexpr uint8_t kStateMask = static_cast<uint8_t>((1u << kStateBits) - 1);
+				static constexpr uint8_t kStateAllocated = static_cast<uint8_t>(1u << (kStateBits - 1));
+				static constexpr uint8_t kStateDecayMask = 0x3;
+				static constexpr uint8_t kStateDecommitted = 0x4;		//Needs T_ALLOCATOR::Commit before it is handed out
+
+				static inline size_t StateBytes(size_t blockCount) { return (blockCount + kStatesPerByte - 1) / kStatesPerByte; }
+
+				static std::shared_ptr<Pool> Create(size_t blockCount)
+				{
+					void* pStorage = ::operator new(sizeof(Pool) + StateBytes(blockCount));
+					return std::shared_ptr<Pool>(new (pStorage) Pool(blockCount), [](Pool* pool)
+					{
+						pool->~Pool();
+						::operator delete(pool);
+					});
+				}
+
+				std::vector<uint32_t> m_freeList = {};		//Freed blocks waiting for reuse, taken from the back. Blocks from m_bumpWatermark up have never been handed out.
+				typename T_ALLOCATOR::Memory m_platformMemory = T_ALLOCATOR::kMemoryDefault;
+				size_t m_poolBytes = 0;			//Blocks plus colour offset
+				size_t m_colorOffset = 0;		//Bytes before the first block, see ColoringPolicy and ThreadSlabPolicy
+				uint64_t m_slabOwner = 0;		//Owning thread when the class uses ThreadSlabPolicy, set through PoolDirectory::SetSlabOwner
+				size_t m_classIdx = 0;
+				PoolDirectory* m_directory = nullptr;		//Null while the pool is out for decay
+				size_t m_directoryIdx = 0;
+				size_t m_commitWatermark = 0;	//Bytes from m_platformMemory known to be committed, the whole pool unless it was reserved
+				bool m_bZeroedMemory = false;	//Created from memory T_ALLOCATOR::IsZeroed vouched for, so blocks above the bump watermark read as zero
+
+				//Decay bookkeeping, idle times are stamped by Tick rather than on free so the free path never reads a clock.
+				//Block stamps only exist while decay is enabled and cover the blocks below the bump watermark.
+				std::vector<uint64_t> m_blockIdleSinceMs = {};
+				uint64_t m_idleSinceMs = 0;
+				uint8_t m_decayStage = kDecayNone;
+				inline void EnableIdleStamps()
+				{
+					if (m_blockIdleSinceMs.size() < m_bumpWatermark)
+						m_blockIdleSinceMs.resize(m_bumpWatermark, 0);
+				}
+				inline void DropIdleStamps()
+				{
+					std::vector<uint64_t>().swap(m_blockIdleSinceMs);
+					m_idleSinceMs = 0;
+				}
+
+				//Handle to patch when Compact moves the block, only kept for handle backed blocks and sized up to the bump watermark as they appear
+				inline LocalAllocation* Owner(size_t blockIdx) const { return blockIdx < m_owners.size() ? m_owners[blockIdx] : nullptr; }
+				inline void SetOwner(size_t blockIdx, LocalAllocation* owner)
+				{
+					if (blockIdx >= m_owners.size())
+					{
+						if (!owner)
+							return;
+						m_owners.resize(m_bumpWatermark, nullptr);
+					}
+					m_owners[blockIdx] = owner;
+				}
+
+				//BufferRef counts, only allocated once a pool hands out its first shared block
+				std::unique_ptr<std::atomic<uint32_t>[]> m_bufferRefs;
+				inline void EnableBufferRefs()
+				{
+					if (!m_bufferRefs)
+						m_bufferRefs.reset(new std::atomic<uint32_t>[m_blockCount]());
+				}
+
+				//Requested sizes, only allocated once a block is handed out with MemoryAllocator::TrackRequestedBytes on. 0 is unknown.
+				std::unique_ptr<uint32_t[]> m_requestedBytes;
+				inline void SetRequestedBytes(size_t blockIdx, size_t requestedBytes)
+				{
+					if (!m_requestedBytes)
+						m_requestedBytes.reset(new uint32_t[m_blockCount]());
+					m_requestedBytes[blockIdx] = static_cast<uint32_t>((std::min<size_t>)(requestedBytes, UINT32_MAX));
+				}
+				inline size_t RequestedBytes(size_t blockIdx) const { return m_requestedBytes ? m_requestedBytes[blockIdx] : 0; }
+
+				inline bool IsAllocated(size_t blockIdx) const { return (State(blockIdx) & kStateAllocated) != 0; }
+				inline typename T_ALLOCATOR::Type BlockType(size_t blockIdx) const { return static_cast<typename T_ALLOCATOR::Type>(State(blockIdx) & (kStateAllocated - 1)); }
+				inline uint8_t DecayStage(size_t blockIdx) const { return State(blockIdx) & kStateDecayMask; }
+				inline void SetDecayStage(size_t blockIdx, uint8_t stage) { SetState(blockIdx, static_cast<uint8_t>((State(blockIdx) & ~kStateDecayMask) | stage)); }
+				inline bool IsDecommitted(size_t blockIdx) const { return (State(blockIdx) & (kStateAllocated | kStateDecommitted)) == kStateDecommitted; }
+				inline void MarkDecommitted(size_t blockIdx) { SetState(blockIdx, State(blockIdx) | kStateDecommitted); }
+
+				//Blocks being purged are counted as allocated so the pool can't be trimmed or compacted underneath the purge
+				inline void ReserveForDecay()
+				{
+					m_activeAllocationCount++;
+					SyncDirectory();
+				}
+				inline void ReturnFromDecay(size_t blockIdx)
+				{
+					m_activeAllocationCount--;
+					m_freeList.push_back(static_cast<uint32_t>(blockIdx));
+					SyncDirectory();
+				}
+
+				virtual void Deallocate(size_t blockIdx) override
+				{
+					m_activeAllocationCount--;
+					SetOwner(blockIdx, nullptr);
+					if (m_requestedBytes)
+						m_requestedBytes[blockIdx] = 0;
+					SetState(blockIdx, kDecayNone);
+					m_freeList.push_back(static_cast<uint32_t>(blockIdx));
+					SyncDirectory();
+				}
+				//Blocks not in freeBlocks are live raw blocks
+				void Restore(const std::vector<uint32_t>& types, const std::vector<uint32_t>& freeBlocks)
+				{
+					for (size_t i = 0; i < m_blockCount; i++)
+						SetState(i, static_cast<uint8_t>(kStateAllocated | (types[i] & (kStateAllocated - 1))));
+					for (auto blockIdx : freeBlocks)
+						SetState(blockIdx, kDecayNone);
+					m_freeList.assign(freeBlocks.rbegin(), freeBlocks.rend());
+					m_activeAllocationCount = m_blockCount - freeBlocks.size();
+					m_bumpWatermark = m_blockCount;
+				}
+				//Blocks never handed out since the pool was created
+				inline size_t UntouchedBlockCount() const { return m_blockCount - m_bumpWatermark; }
+				inline size_t BumpWatermark() const { return m_bumpWatermark; }
+				inline size_t BlockCount() const { return m_blockCount; }
+				inline size_t ActiveAllocationCount() const { return m_activeAllocationCount; }
+				inline bool IsFull() const { return m_activeAllocationCount == m_blockCount; }
+				inline float Occupancy() const { return static_cast<float>(m_activeAllocationCount) / static_cast<float>(m_blockCount); }
+
+				//Header, packed states and the per block side tables
+				size_t MetadataBytes() const
+				{
+					size_t bytes = sizeof(Pool) + StateBytes(m_blockCount);
+					bytes += m_owners.capacity() * sizeof(LocalAllocation*);
+					bytes += m_blockIdleSinceMs.capacity() * sizeof(uint64_t);
+					bytes += m_freeList.capacity() * sizeof(uint32_t);
+					if (m_bufferRefs)
+						bytes += m_blockCount * sizeof(std::atomic<uint32_t>);
+					if (m_requestedBytes)
+						bytes += m_blockCount * sizeof(uint32_t);
+					return bytes;
+				}
+
+				//bDecommitted receives whether the block must be committed before use
+				std::optional<size_t> Allocate(typename T_ALLOCATOR::Type memoryType, bool& bDecommitted)
+				{
+					if (m_activeAllocationCount == m_blockCount)
+						return {};
+
+					//Reused blocks first, the most recently freed is the most likely to still be in cache
+					size_t front = m_bumpWatermark;
+					if (!m_freeList.empty())
+					{
+						front = m_freeList.back();
+						m_freeList.pop_back();
+					}
+					else if (m_bumpWatermark < m_blockCount)
+					{
+						m_bumpWatermark++;
+					}
+					else
+					{
+						return {};
+					}
+
+					bDecommitted = IsDecommitted(front);
+					SetState(front, static_cast<uint8_t>(kStateAllocated | (static_cast<uint32_t>(memoryType) & (kStateAllocated - 1))));
+					if (front < m_blockIdleSinceMs.size())
+						m_blockIdleSinceMs[front] = 0;
+					m_idleSinceMs = 0;
+					m_decayStage = kDecayNone;
+					m_activeAllocationCount++;
+					SyncDirectory();
+					return front;
+				}
+			private:
+				Pool(size_t blockCount) : m_blockCount(blockCount)
+				{
+					memset(States(), 0, StateBytes(blockCount));
+				}
+
+				inline void SyncDirectory()
+				{
+					if (m_directory)
+						m_directory->m_freeCounts[m_directoryIdx] = static_cast<uint32_t>(m_blockCount - m_activeAllocationCount);
+				}
+
+				inline uint8_t* States() { return reinterpret_cast<uint8_t*>(this + 1); }
+				inline const uint8_t* States() const { return reinterpret_cast<const uint8_t*>(this + 1); }
+				inline uint8_t State(size_t blockIdx) const
+				{
+					const size_t shift = (blockIdx % kStatesPerByte) * kStateBits;
+					return static_cast<uint8_t>((States()[blockIdx / kStatesPerByte] >> shift) & kStateMask);
+				}
+				inline void SetState(size_t blockIdx, uint8_t state)
+				{
+					const size_t shift = (blockIdx % kStatesPerByte) * kStateBits;
+					uint8_t& packed = States()[blockIdx / kStatesPerByte];
+					packed = static_cast<uint8_t>((packed & ~(kStateMask << shift)) | ((state & kStateMask) << shift));
+				}
+
+				std::vector<LocalAllocation*> m_owners = {};
+				size_t m_activeAllocationCount = 0;
+				size_t m_blockCount = 0;
+				size_t m_bumpWatermark = 0;
+			};
+
+
+			//Dense per class index of the pools allocation can use, one entry per pool in matching order. Looking for room or for empty
+			//pools walks these arrays instead of each pool's header. Pools keep their entry's free count current through SyncDirectory.
+			struct PoolDirectory
+			{
+				static constexpr size_t kNoEntry = ~size_t(0);
+
+				void Add(const std::shared_ptr<Pool>& pool)
+				{
+					pool->m_directory = this;
+					pool->m_directoryIdx = m_headers.size();
+					m_pools.push_back(pool);
+					m_headers.push_back(pool.get());
+					m_bases.push_back(pool->m_platformMemory);
+					m_freeCounts.push_back(static_cast<uint32_t>(pool->BlockCount() - pool->ActiveAllocationCount()));
+					m_blockCounts.push_back(static_cast<uint32_t>(pool->BlockCount()));
+					m_slabOwners.push_back(pool->m_slabOwner);
+				}
+
+				void Erase(size_t entryIdx)
+				{
+					m_headers[entryIdx]->m_directory = nullptr;
+					m_pools.erase(m_pools.begin() + entryIdx);
+					m_headers.erase(m_headers.begin() + entryIdx);
+					m_bases.erase(m_bases.begin() + entryIdx);
+					m_freeCounts.erase(m_freeCounts.begin() + entryIdx);
+					m_blockCounts.erase(m_blockCounts.begin() + entryIdx);
+					m_slabOwners.erase(m_slabOwners.begin() + entryIdx);
+					for (size_t i = entryIdx; i < m_headers.size(); i++)
+						m_headers[i]->m_directoryIdx = i;
+				}
+
+				void Clear()
+				{
+					for (Pool* pool : m_headers)
+						pool->m_directory = nullptr;
+					m_pools.clear();
+					m_headers.clear();
+					m_bases.clear();
+					m_freeCounts.clear();
+					m_blockCounts.clear();
+					m_slabOwners.clear();
+				}
+
+				inline void SetSlabOwner(size_t entryIdx, uint64_t slabOwner)
+				{
+					m_headers[entryIdx]->m_slabOwner = slabOwner;
+					m_slabOwners[entryIdx] = slabOwner;
+				}
+
+				//First entry from firstIdx with a free block and the given owner
+				inline size_t FindWithRoom(size_t firstIdx, uint64_t slabOwner) const
+				{
+					for (size_t i = firstIdx; i < m_freeCounts.size(); i++)
+					{
+						if (m_freeCounts[i] != 0 && m_slabOwners[i] == slabOwner)
+							return i;
+					}
+					return kNoEntry;
+				}
+
+				inline size_t FindEmpty(size_t firstIdx) const
+				{
+					for (size_t i = firstIdx; i < m_freeCounts.size(); i++)
+					{
+						if (m_freeCounts[i] == m_blockCounts[i])
+							return i;
+					}
+					return kNoEntry;
+				}
+
+				inline bool IsEmpty(size_t entryIdx) const { return m_freeCounts[entryIdx] == m_blockCounts[entryIdx]; }
+				inline size_t Count() const { return m_headers.size(); }
+				inline Pool& Header(size_t entryIdx) const { return *m_headers[entryIdx]; }
+				inline const std::shared_ptr<Pool>& Owned(size_t entryIdx) const { return m_pools[entryIdx]; }
+				inline const std::vector<std::shared_ptr<Pool>>& Pools() const { return m_pools; }
+				inline const std::vector<Pool*>& Headers() const { return m_headers; }
+				inline const std::vector<typename T_ALLOCATOR::Memory>& Bases() const { return m_bases; }
+				inline const std::vector<uint32_t>& FreeCounts() const { return m_freeCounts; }
+				inline const std::vector<uint32_t>& BlockCounts() const { return m_blockCounts; }
+
+				size_t MetadataBytes() const
+				{
+					return m_pools.capacity() * sizeof(std::shared_ptr<Pool>) + m_headers.capacity() * sizeof(Pool*) + m_bases.capacity() * sizeof(typename T_ALLOCATOR::Memory)
+						+ (m_freeCounts.capacity() + m_blockCounts.capacity()) * sizeof(uint32_t) + m_slabOwners.capacity() * sizeof(uint64_t);
+				}
+
+			private:
+				friend struct Pool;
+
+				std::vector<std::shared_ptr<Pool>> m_pools;		//Ownership only, kept out of the arrays that get scanned
+				std::vector<Pool*> m_headers;
+				std::vector<typename T_ALLOCATOR::Memory> m_bases;
+				std::vector<uint32_t> m_freeCounts;
+				std::vector<uint32_t> m_blockCounts;
+				std::vector<uint64_t> m_slabOwners;
+			};
+
+			const PoolSizeConstructor kSizeClass;
+			const size_t kBlockSize;
+			const size_t kBlockCount;
+
+			PoolDirectory m_directory;
+			std::vector<Pool*> m_poolsByAddress;		//Every mapped pool including those out for decay, sorted by m_platformMemory
+			T_ALLOCATOR& m_platformAllocator;
+			LatencyRecorder* m_latency;
+			HeapProfiler* m_heapProfiler;
+			size_t m_classIdx;
+			size_t m_nextPoolBlockCount = 0;
+			size_t m_totalBlockCount = 0;
+			size_t m_lentTotal = 0;			//Blocks ever handed to a smaller class, frees aren't told apart so this never goes down
+			size_t m_nextColor = 0;
+			size_t m_blockStride;				//kBlockSize, padded to whole cache lines for thread owned classes
+			size_t m_firstBlockAlignment = 0;
+			bool m_bThreadOwned = false;
+
+			static constexpr size_t kCommitGranularity = 1024 * 64;
+
+		private:
+			inline typename T_ALLOCATOR::Memory BlockMemory(const Pool& pool, size_t blockIdx)
+			{
+				return m_platformAllocator.Offset(pool.m_platformMemory, pool.m_colorOffset + blockIdx * m_blockStride);
+			}
+
+			inline Pool* AddNewPool(const GrowthPolicy& growthPolicy, size_t blockCount, size_t colorOffset)
+			{
+				const size_t alignmentSlack = AlignmentSlack();
+				const size_t poolBytes = blockCount * m_blockStride + colorOffset + alignmentSlack;
+				typename T_ALLOCATOR::Memory platformMemory;
+				{
+					LatencyScope platformTimer(*m_latency, m_classIdx, LatencyEvent::PlatformAllocate, m_latency->IsEnabled());
+					if constexpr (kUsesReserve<T_ALLOCATOR>)
+						platformMemory = m_platformAllocator.Reserve(poolBytes);
+					else
+						platformMemory = m_platformAllocator.Allocate(poolBytes, (std::max)(T_ALLOCATOR::kAlignment, m_firstBlockAlignment));
+				}
+				if (platformMemory == T_ALLOCATOR::kMemoryDefault)
+					return nullptr;
+
+				if constexpr (std::is_pointer<typename T_ALLOCATOR::Memory>::value)
+				{
+					if (alignmentSlack)
+					{
+						const uintptr_t address = reinterpret_cast<uintptr_t>(platformMemory);
+						colorOffset += (m_firstBlockAlignment - address % m_firstBlockAlignment) % m_firstBlockAlignment;
+					}
+				}
+
+				m_nextPoolBlockCount = growthPolicy.NextPoolBlockCount(kSizeClass, PlannedPoolBlockCount(growthPolicy));
+				m_totalBlockCount += blockCount;
+				m_nextColor++;
+
+				auto newPool = Pool::Create(blockCount);
+				newPool->m_classIdx = m_classIdx;
+				newPool->m_platformMemory = platformMemory;
+				newPool->m_poolBytes = poolBytes;
+				newPool->m_colorOffset = colorOffset;
+				newPool->m_commitWatermark = kUsesReserve<T_ALLOCATOR> ? 0 : poolBytes;
+				if constexpr (HasIsZeroed<T_ALLOCATOR>::value)
+				{
+					newPool->m_bZeroedMemory = m_platformAllocator.IsZeroed(platformMemory, poolBytes);
+				}
+				m_poolsByAddress.insert(std::upper_bound(m_poolsByAddress.begin(), m_poolsByAddress.end(), newPool.get(), PoolAddressLess), newPool.get());
+				m_directory.Add(newPool);
+				MEMORY_ALLOCATOR_PROBE(pool_add, poolBytes, m_classIdx, platformMemory);
+				return newPool.get();
+			}
+
+			static inline bool PoolAddressLess(const Pool* a, const Pool* b)
+			{
+				return std::less<typename T_ALLOCATOR::Memory>()(a->m_platformMemory, b->m_platformMemory);
+			}
+
+			inline void RemoveFromAddressIndex(const Pool& pool)
+			{
+				auto it = std::lower_bound(m_poolsByAddress.begin(), m_poolsByAddress.end(), &pool, PoolAddressLess);
+				if (it != m_poolsByAddress.end() && *it == &pool)
+					m_poolsByAddress.erase(it);
+			}
+
+			inline size_t ReleasePool(Pool& pool)
+			{
+				RemoveFromAddressIndex(pool);
+				MEMORY_ALLOCATOR_PROBE(pool_release, pool.m_poolBytes, m_classIdx, pool.m_platformMemory);
+				{
+					LatencyScope platformTimer(*m_latency, m_classIdx, LatencyEvent::PlatformFree, m_latency->IsEnabled());
+					m_platformAllocator.Free(pool.m_platformMemory, pool.m_poolBytes);
+				}
+				pool.m_platformMemory = T_ALLOCATOR::kMemoryDefault;
+				m_totalBlockCount -= pool.BlockCount();
+				return pool.m_poolBytes;
+			}
+
+			//Takes a free block, committing it first when the pool was reserved or decay decommitted it
+			inline std::optional<size_t> TakeBlock(Pool& pool, typename T_ALLOCATOR::Type memoryType, bool& bZeroed)
+			{
+				const size_t untouchedFrom = pool.BumpWatermark();
+				bool bDecommitted = false;
+				auto blockIdx = pool.Allocate(memoryType, bDecommitted);
+				if (!blockIdx)
+					return {};
+				if constexpr (HasCommit<T_ALLOCATOR>::value)
+				{
+					if (!CommitBlock(pool, *blockIdx, bDecommitted))
+					{
+						pool.Deallocate(*blockIdx);
+						if (bDecommitted)
+							pool.MarkDecommitted(*blockIdx);
+						return {};
+					}
+				}
+				bZeroed = pool.m_bZeroedMemory && *blockIdx >= untouchedFrom;
+				return blockIdx;
+			}
+
+			//Reserved pools are committed kCommitGranularity at a time from the front
+			inline bool CommitBlock(Pool& pool, size_t blockIdx, bool bDecommitted)
+			{
+				const size_t blockBegin = pool.m_colorOffset + blockIdx * m_blockStride;
+				const size_t blockEnd = blockBegin + m_blockStride;
+				const size_t previousWatermark = pool.m_commitWatermark;
+				if (blockEnd > previousWatermark)
+				{
+					const size_t commitEnd = (std::min)(pool.m_poolBytes, (std::max)(blockEnd, previousWatermark + kCommitGranularity));
+					if (!m_platformAllocator.Commit(m_platformAllocator.Offset(pool.m_platformMemory, previousWatermark), commitEnd - previousWatermark))
+						return false;
+					pool.m_commitWatermark = commitEnd;
+				}
+				//A block decommitted before the watermark reached it was covered above
+				if (bDecommitted && blockBegin < previousWatermark)
+					return m_platformAllocator.Commit(BlockMemory(pool, blockIdx), m_blockStride);
+				return true;
+			}
+
+			inline void AssignBlock(LocalAllocation& allocation, Pool& pool, size_t blockIdx, bool bZeroed = false)
+			{
+				allocation.m_bZeroed = bZeroed;
+				allocation.blockIdx = blockIdx;
+				allocation.m_poolAllocatedFrom = &pool;
+				allocation.m_platformMemory = BlockMemory(pool, blockIdx);
+				pool.SetOwner(blockIdx, allocation.m_bRaw ? nullptr : &allocation);
+			}
+
+			//Returns false when the destination block couldn't be committed
+			inline bool MoveBlock(Pool& source, size_t blockIdx, Pool& destination)
+			{
+				LocalAllocation& owner = *source.Owner(blockIdx);
+				bool bZeroed = false;
+				const auto newBlockIdx = TakeBlock(destination, source.BlockType(blockIdx), bZeroed);
+				if (!newBlockIdx)
+					return false;
+				if constexpr (HasCopy<T_ALLOCATOR>::value)
+					m_platformAllocator.Copy(BlockMemory(destination, *newBlockIdx), owner.m_platformMemory, kBlockSize);
+				const auto sourceMemory = owner.m_platformMemory;
+				if (const size_t requestedBytes = source.RequestedBytes(blockIdx))
+					destination.SetRequestedBytes(*newBlockIdx, requestedBytes);
+				source.Deallocate(blockIdx);
+				AssignBlock(owner, destination, *newBlockIdx);
+				owner.m_owner->PublishHandleMemory(owner);
+				m_heapProfiler->Move(ProbeAddress(sourceMemory), ProbeAddress(owner.m_platformMemory));
+				return true;
+			}
+		};
+
+		T_ALLOCATOR&		m_allocator;
+		SizeClassTable		m_sizeClasses;
+		std::vector<PoolList> m_poolLists;
+		LatencyRecorder		m_latency;
+		HeapProfiler		m_heapProfiler;
+		GrowthPolicy		m_growthPolicy;
+		BorrowPolicy		m_borrowPolicy;
+		ColoringPolicy		m_coloringPolicy;
+		ThreadSlabPolicy	m_threadSlabPolicy;
+		size_t				m_budgetBytes = 0;
+		size_t				m_committedBytes = 0;
+		size_t				m_largeAllocationBytes = 0;
+		std::map<typename T_ALLOCATOR::Memory, size_t> m_largeRawAllocations;
+		std::vector<std::pair<CallbackId, LowMemoryCallback>> m_lowMemoryCallbacks;
+		CallbackId			m_nextCallbackId = 1;
+		std::unique_ptr<std::atomic<HandleSlot*>[]> m_handleChunks;		//One entry per kHandleChunkSlots, null until the chunk is needed
+		std::atomic<uint32_t> m_handleCapacity{ 0 };
+		uint32_t			m_handleSlotCount = 0;			//Slots in allocated chunks
+		uint32_t			m_firstFreeHandle = HandleSlot::kNoFreeSlot;
+		uint32_t			m_lastFreeHandle = HandleSlot::kNoFreeSlot;
+		EpochReclaimer<RetiredMemory> m_epochReclaimer;
+		DecayPolicy			m_decayPolicy;
+		std::mutex			m_tickMutex;
+		std::thread			m_decayThread;
+		std::mutex			m_decayThreadMutex;
+		std::condition_variable m_decayThreadWake;
+		bool				m_bStopDecayThread = false;
+		bool				m_bTrackRequestedBytes = false;
+		mutable std::mutex	m_mutex;
 	};
-}
 
+#if __has_include(<memory_resource>)
+	//std::pmr adapter over the raw API so deallocation takes the sized Free path.
+	//Blocks are only assumed aligned to max_align_t, anything over aligned goes to the upstream resource.
+	template<BLOCK_ALLOCATOR_PLATFORM_ALLOCATOR T_ALLOCATOR>
+	class PoolMemoryResource : public std::pmr::memory_resource
+	{
+		static_assert(std::is_pointer<typename T_ALLOCATOR::Memory>::value, "PoolMemoryResource needs an allocator handing out pointers");
+	public:
+		PoolMemoryResource(MemoryAllocator<T_ALLOCATOR>& allocator, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) : m_allocator(allocator), m_upstream(upstream)
+		{
+
+		}
+
+	private:
+		void* do_allocate(size_t bytes, size_t alignment) override
+		{
+			if (alignment > alignof(std::max_align_t))
+				return m_upstream->allocate(bytes, alignment);
+			void* pMemory = m_allocator.AllocateRaw(bytes, T_ALLOCATOR::Type::Other);
+			if (pMemory == nullptr)
+				throw std::bad_alloc();
+			return pMemory;
+		}
+		void do_deallocate(void* pMemory, size_t bytes, size_t alignment) override
+		{
+			if (alignment > alignof(std::max_align_t))
+				m_upstream->deallocate(pMemory, bytes, alignment);
+			else
+				m_allocator.Free(pMemory, bytes);
+		}
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+		{
+			return this == &other;
+		}
+
+		MemoryAllocator<T_ALLOCATOR>& m_allocator;
+		std::pmr::memory_resource* m_upstream;
+	};
+#endif
+}
@@ -0,0 +1,187 @@
+#pragma once
+#include "MemoryAllocator.h"
+#include "RangeTable.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace Templated
+{
+	//Page granular platform allocator, pools come straight from the OS so idle blocks can be handed back with Purge or Decommit.
+	//Pools are reserved and committed as they fill. On Windows that is real commit charge, elsewhere the mapping is made without
+	//reserving swap and Commit has nothing to do. Shares the CPPAllocator size classes and constants.
+	struct MMapAllocator : public CPPAllocator
+	{
+	public:
+		Memory Allocate(Size memorySize, Size /*memoryAlignment*/)
+		{
+#if defined(_WIN32)
+			return VirtualAlloc(nullptr, memorySize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+			void* pMemory = mmap(nullptr, memorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			return pMemory == MAP_FAILED ? kMemoryDefault : pMemory;
+#endif
+		}
+		void Free(Memory pMemory, Size memorySize)
+		{
+#if defined(_WIN32)
+			(void)memorySize;
+			VirtualFree(pMemory, 0, MEM_RELEASE);
+#else
+			munmap(pMemory, memorySize);
+#endif
+		}
+
+		Memory Reserve(Size memorySize)
+		{
+#if defined(_WIN32)
+			return VirtualAlloc(nullptr, memorySize, MEM_RESERVE, PAGE_NOACCESS);
+#else
+			void* pMemory = mmap(nullptr, memorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			return pMemory == MAP_FAILED ? kMemoryDefault : pMemory;
+#endif
+		}
+
+		//Commits every page the range touches
+		bool Commit(Memory pMemory, Size memorySize)
+		{
+#if defined(_WIN32)
+			const Size pageSize = PageSize();
+			const uintptr_t begin = reinterpret_cast<uintptr_t>(pMemory) & ~(pageSize - 1);
+			const uintptr_t end = (reinterpret_cast<uintptr_t>(pMemory) + memorySize + pageSize - 1) & ~(pageSize - 1);
+			return VirtualAlloc(reinterpret_cast<void*>(begin), end - begin, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+			(void)pMemory;
+			(void)memorySize;
+			return true;
+#endif
+		}
+
+		//Only whole pages inside the range are decommitted, they read back as zero once committed again
+		void Decommit(Memory pMemory, Size memorySize)
+		{
+			void* pDecommit = nullptr;
+			Size decommitSize = 0;
+			if (!InnerPages(pMemory, memorySize, pDecommit, decommitSize))
+				return;
+#if defined(_WIN32)
+			VirtualFree(pDecommit, decommitSize, MEM_DECOMMIT);
+#else
+			madvise(pDecommit, decommitSize, MADV_DONTNEED);
+#endif
+		}
+
+		//Fresh mappings are always zero filled
+		bool IsZeroed(Memory /*pMemory*/, Size /*memorySize*/)
+		{
+			return true;
+		}
+
+		//Lazy lets the OS take the pages when it wants them, Now drops them immediately and they read back as zero.
+		//Only whole pages inside the range are purged.
+		void Purge(Memory pMemory, Size memorySize, PurgeMode purgeMode)
+		{
+			void* pPurge = nullptr;
+			Size purgeSize = 0;
+			if (!InnerPages(pMemory, memorySize, pPurge, purgeSize))
+				return;
+#if defined(_WIN32)
+			if (purgeMode == PurgeMode::Lazy)
+			{
+				VirtualAlloc(pPurge, purgeSize, MEM_RESET, PAGE_READWRITE);
+			}
+			else
+			{
+				VirtualFree(pPurge, purgeSize, MEM_DECOMMIT);
+				VirtualAlloc(pPurge, purgeSize, MEM_COMMIT, PAGE_READWRITE);
+			}
+#else
+#ifdef MADV_FREE
+			madvise(pPurge, purgeSize, purgeMode == PurgeMode::Lazy ? MADV_FREE : MADV_DONTNEED);
+#else
+			madvise(pPurge, purgeSize, MADV_DONTNEED);
+#endif
+#endif
+		}
+
+		static bool InnerPages(Memory pMemory, Size memorySize, void*& pPages, Size& pagesSize)
+		{
+			const Size pageSize = PageSize();
+			const uintptr_t begin = (reinterpret_cast<uintptr_t>(pMemory) + pageSize - 1) & ~(pageSize - 1);
+			const uintptr_t end = (reinterpret_cast<uintptr_t>(pMemory) + memorySize) & ~(pageSize - 1);
+			if (end <= begin)
+				return false;
+			pPages = reinterpret_cast<void*>(begin);
+			pagesSize = end - begin;
+			return true;
+		}
+
+		static Size PageSize()
+		{
+#if defined(_WIN32)
+			SYSTEM_INFO systemInfo;
+			GetSystemInfo(&systemInfo);
+			return systemInfo.dwPageSize;
+#else
+			return static_cast<Size>(sysconf(_SC_PAGESIZE));
+#endif
+		}
+	};
+	template<>
+	struct UsesEnvironmentSizeClasses<MMapAllocator> : std::true_type {};
+
+	//Sub-allocates an abstract address range the caller owns, eg a region of a huge file, a device buffer or remote memory.
+	//Memory is an offset inside [rangeBegin, rangeBegin + rangeBytes). Nothing is ever read or written through it, all free lists and
+	//block state stay in MemoryAllocator's own metadata and the RangeTable here. With no Copy hook Compact leaves blocks where they are.
+	struct OffsetRangeAllocator : public CPPAllocator
+	{
+	public:
+		using Memory = uint64_t;
+		static constexpr Memory kMemoryDefault = ~Memory(0);
+
+		//Pools start on a multiple of granularity, eg the device block size for direct I/O
+		OffsetRangeAllocator(uint64_t rangeBegin, uint64_t rangeBytes, Size granularity = kAlignment) : m_granularity((std::max)(granularity, Size(1)))
+		{
+			m_ranges.Reset(rangeBegin, rangeBegin + rangeBytes);
+		}
+
+		Memory Allocate(Size memorySize, Size memoryAlignment)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const uint64_t begin = m_ranges.Allocate(RangeTable::AlignUp(memorySize, m_granularity), (std::max)(memoryAlignment, m_granularity));
+			return begin == RangeTable::kNoRange ? kMemoryDefault : begin;
+		}
+		inline Memory Offset(Memory memoryIn, Size blockSize)
+		{
+			return memoryIn + blockSize;
+		}
+		inline Size Distance(Memory memoryBase, Memory memoryIn)
+		{
+			return static_cast<Size>(memoryIn - memoryBase);
+		}
+		void Free(Memory memory, Size memorySize)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_ranges.Free(memory, memory + RangeTable::AlignUp(memorySize, m_granularity));
+		}
+
+		//Bytes of the range not yet handed out at the end, freed ranges in the middle aren't counted
+		uint64_t UntouchedBytes() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_ranges.End() - m_ranges.BumpOffset();
+		}
+
+	private:
+		Size m_granularity;
+		RangeTable m_ranges;
+		mutable std::mutex m_mutex;
+	};
+}
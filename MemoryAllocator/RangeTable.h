@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <map>
+
+namespace Templated
+{
+	//Bookkeeping for carving ranges out of [begin, end) without touching the range itself. Freed ranges are coalesced and reused first fit,
+	//otherwise ranges grow into the untouched end tracked by the bump offset. Not thread safe, owners lock around it.
+	class RangeTable
+	{
+	public:
+		static constexpr uint64_t kNoRange = ~uint64_t(0);
+
+		void Reset(uint64_t begin, uint64_t end)
+		{
+			m_freeRanges.clear();
+			m_begin = begin;
+			m_end = end;
+			m_bumpOffset = begin;
+		}
+
+		//Returns kNoRange when nothing fits
+		uint64_t Allocate(uint64_t size, uint64_t alignment)
+		{
+			for (auto it = m_freeRanges.begin(); it != m_freeRanges.end(); ++it)
+			{
+				const uint64_t rangeBegin = it->first;
+				const uint64_t rangeEnd = it->second;
+				const uint64_t begin = AlignUp(rangeBegin, alignment);
+				if (begin + size > rangeEnd)
+					continue;
+
+				m_freeRanges.erase(it);
+				if (begin > rangeBegin)
+					m_freeRanges.emplace(rangeBegin, begin);
+				if (rangeEnd > begin + size)
+					m_freeRanges.emplace(begin + size, rangeEnd);
+				return begin;
+			}
+
+			const uint64_t begin = AlignUp(m_bumpOffset, alignment);
+			if (begin + size > m_end)
+				return kNoRange;
+			if (begin > m_bumpOffset)
+				m_freeRanges.emplace(m_bumpOffset, begin);
+			m_bumpOffset = begin + size;
+			return begin;
+		}
+
+		void Free(uint64_t begin, uint64_t end)
+		{
+			auto next = m_freeRanges.lower_bound(begin);
+			if (next != m_freeRanges.end() && next->first == end)
+			{
+				end = next->second;
+				next = m_freeRanges.erase(next);
+			}
+			if (next != m_freeRanges.begin())
+			{
+				auto previous = std::prev(next);
+				if (previous->second == begin)
+				{
+					begin = previous->first;
+					m_freeRanges.erase(previous);
+				}
+			}
+			if (end == m_bumpOffset)
+				m_bumpOffset = begin;
+			else
+				m_freeRanges.emplace(begin, end);
+		}
+
+		//For restoring a saved table, follow with Free for each saved free range
+		inline void SetBumpOffset(uint64_t bumpOffset) { m_bumpOffset = bumpOffset; }
+
+		inline uint64_t BumpOffset() const { return m_bumpOffset; }
+		inline const std::map<uint64_t, uint64_t>& FreeRanges() const { return m_freeRanges; }
+		inline uint64_t Begin() const { return m_begin; }
+		inline uint64_t End() const { return m_end; }
+
+		static inline uint64_t AlignUp(uint64_t value, uint64_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+
+	private:
+		std::map<uint64_t, uint64_t> m_freeRanges;		//Begin to end
+		uint64_t m_begin = 0;
+		uint64_t m_end = 0;
+		uint64_t m_bumpOffset = 0;
+	};
+}
@@ -0,0 +1,567 @@
+#pragma once
+#include "MemoryAllocator.h"
+#include <atomic>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+namespace Templated
+{
+	//Platform allocator carving pools out of one shared memory segment mapped into several processes.
+	//Memory is a byte offset into the segment so it means the same thing in every process, Pointer() turns it into an address in this one.
+	//Which ranges of the segment are in use lives in the segment header behind a process shared lock, so several processes
+	//can each run their own MemoryAllocator over the same segment. Blocks handed to another process come back through the
+	//owner's return ring, see ReturnToOwner and DrainReturned.
+	//Only the range table is shared. Pool metadata, free lists and block states stay private to the MemoryAllocator of each process, so
+	//when a process dies the pools it held stay in use in the segment until the segment is recreated, and blocks still queued on its
+	//return ring are lost with them. Survivors carry on: the lock is a robust mutex on POSIX and the next process to take it after the
+	//holder died repairs the range table, see RepairFreeRanges. The dead process's slot stays claimed, it never reaches Detach.
+	//Windows has no robust process shared lock without a named kernel object, there a process dying while holding the spin lock
+	//wedges the segment.
+	struct SharedMemoryAllocator : public CPPAllocator
+	{
+	public:
+		using Memory = uint64_t;
+		static constexpr Memory kMemoryDefault = ~Memory(0);
+		static constexpr uint32_t kMaxProcesses = 16;
+		static constexpr uint32_t kNoProcess = ~0u;
+		static constexpr uint32_t kMaxFreeRanges = 1024;
+		static constexpr uint32_t kReturnRingCapacity = 512;		//Power of two
+
+		SharedMemoryAllocator() = default;
+		~SharedMemoryAllocator() { Detach(); }
+		SharedMemoryAllocator(const SharedMemoryAllocator&) = delete;
+		SharedMemoryAllocator& operator=(const SharedMemoryAllocator&) = delete;
+
+		//Creates and maps a new named segment, fails if the name is taken
+		bool Create(const char* name, Size segmentSize)
+		{
+			if (m_pBase || segmentSize <= sizeof(SegmentHeader))
+				return false;
+#if defined(_WIN32)
+			HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(uint64_t(segmentSize) >> 32), static_cast<DWORD>(segmentSize), name);
+			if (mapping == nullptr)
+				return false;
+			if (GetLastError() == ERROR_ALREADY_EXISTS)
+			{
+				CloseHandle(mapping);
+				return false;
+			}
+			return Map(mapping, segmentSize, true);
+#else
+			const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+			if (fd < 0)
+				return false;
+			if (ftruncate(fd, static_cast<off_t>(segmentSize)) != 0)
+			{
+				close(fd);
+				shm_unlink(name);
+				return false;
+			}
+			if (!Map(fd, segmentSize, true))
+			{
+				shm_unlink(name);
+				return false;
+			}
+			return true;
+#endif
+		}
+
+		//Maps a segment another process created
+		bool Open(const char* name)
+		{
+			if (m_pBase)
+				return false;
+#if defined(_WIN32)
+			HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+			if (mapping == nullptr)
+				return false;
+			return Map(mapping, 0, false);
+#else
+			const int fd = shm_open(name, O_RDWR, 0600);
+			if (fd < 0)
+				return false;
+			struct stat fileStat;
+			if (fstat(fd, &fileStat) != 0)
+			{
+				close(fd);
+				return false;
+			}
+			return Map(fd, static_cast<Size>(fileStat.st_size), false);
+#endif
+		}
+
+#if defined(__linux__)
+		//Unnamed segment, share FileDescriptor() with the other processes over a unix socket and Attach it there
+		bool CreateAnonymous(Size segmentSize)
+		{
+			if (m_pBase || segmentSize <= sizeof(SegmentHeader))
+				return false;
+			const int fd = memfd_create("BlockMemoryAllocator", MFD_CLOEXEC);
+			if (fd < 0)
+				return false;
+			if (ftruncate(fd, static_cast<off_t>(segmentSize)) != 0)
+			{
+				close(fd);
+				return false;
+			}
+			return Map(fd, segmentSize, true);
+		}
+
+		//Takes ownership of fd
+		bool Attach(int fd)
+		{
+			if (m_pBase)
+				return false;
+			struct stat fileStat;
+			if (fstat(fd, &fileStat) != 0)
+			{
+				close(fd);
+				return false;
+			}
+			return Map(fd, static_cast<Size>(fileStat.st_size), false);
+		}
+
+		inline int FileDescriptor() const { return m_fd; }
+#endif
+
+		//Removes the name, processes that already mapped the segment keep it
+		static bool Unlink(const char* name)
+		{
+#if defined(_WIN32)
+			(void)name;
+			return true;
+#else
+			return shm_unlink(name) == 0;
+#endif
+		}
+
+		//Unmaps the segment and gives up this process's slot. Every MemoryAllocator using it must be destroyed first.
+		void Detach()
+		{
+			if (!m_pBase)
+				return;
+			if (m_processSlot != kNoProcess)
+				Header().m_processSlots.fetch_and(~(1u << m_processSlot), std::memory_order_acq_rel);
+#if defined(_WIN32)
+			UnmapViewOfFile(m_pBase);
+			CloseHandle(m_mapping);
+			m_mapping = nullptr;
+#else
+			munmap(m_pBase, m_segmentSize);
+			close(m_fd);
+			m_fd = -1;
+#endif
+			m_pBase = nullptr;
+			m_segmentSize = 0;
+			m_processSlot = kNoProcess;
+		}
+
+		inline bool IsAttached() const { return m_pBase != nullptr; }
+		inline Size SegmentSize() const { return m_segmentSize; }
+
+		//Identifies this process's return ring, kNoProcess when all kMaxProcesses slots were taken
+		inline uint32_t ProcessSlot() const { return m_processSlot; }
+
+		inline void* Pointer(Memory memory) const { return memory == kMemoryDefault ? nullptr : m_pBase + memory; }
+		inline Memory ToMemory(const void* pMemory) const { return pMemory == nullptr ? kMemoryDefault : static_cast<Memory>(static_cast<const char*>(pMemory) - m_pBase); }
+
+		//Hands a block received from another process back to the process that allocated it, false when its ring is full
+		bool ReturnToOwner(uint32_t ownerSlot, Memory memory, Size memorySize)
+		{
+			if (ownerSlot >= kMaxProcesses)
+				return false;
+			ReturnRing& ring = Header().m_returnRings[ownerSlot];
+			uint64_t position = ring.m_enqueue.load(std::memory_order_relaxed);
+			for (;;)
+			{
+				ReturnCell& cell = ring.m_cells[position & (kReturnRingCapacity - 1)];
+				const uint64_t sequence = cell.m_sequence.load(std::memory_order_acquire);
+				if (sequence == position)
+				{
+					if (ring.m_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					{
+						cell.m_memory = memory;
+						cell.m_size = memorySize;
+						cell.m_sequence.store(position + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (sequence < position)
+				{
+					return false;
+				}
+				else
+				{
+					position = ring.m_enqueue.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		//Calls freeBlock(Memory, Size) for every block other processes returned to this one, typically MemoryAllocator::Free. Returns the count.
+		template<typename T_FREE>
+		size_t DrainReturned(T_FREE&& freeBlock)
+		{
+			if (m_processSlot == kNoProcess)
+				return 0;
+			ReturnRing& ring = Header().m_returnRings[m_processSlot];
+			size_t drainedCount = 0;
+			for (;;)
+			{
+				const uint64_t position = ring.m_dequeue.load(std::memory_order_relaxed);
+				ReturnCell& cell = ring.m_cells[position & (kReturnRingCapacity - 1)];
+				if (cell.m_sequence.load(std::memory_order_acquire) != position + 1)
+					return drainedCount;
+				const Memory memory = cell.m_memory;
+				const Size memorySize = static_cast<Size>(cell.m_size);
+				ring.m_dequeue.store(position + 1, std::memory_order_relaxed);
+				cell.m_sequence.store(position + kReturnRingCapacity, std::memory_order_release);
+				freeBlock(memory, memorySize);
+				drainedCount++;
+			}
+		}
+
+		//Bytes lost because the free range table was full when they were freed
+		uint64_t LeakedBytes() const
+		{
+			SegmentLock lock(Header());
+			return Header().m_leakedBytes;
+		}
+
+		//T_ALLOCATOR interface. Ranges are rounded up to kAlignment and taken first fit from freed ranges before growing into the untouched end.
+		Memory Allocate(Size memorySize, Size memoryAlignment)
+		{
+			if (!m_pBase)
+				return kMemoryDefault;
+			memorySize = AlignUp(memorySize, kAlignment);
+			memoryAlignment = (std::max)(memoryAlignment, kAlignment);
+
+			SegmentHeader& header = Header();
+			SegmentLock lock(header);
+			for (uint32_t i = 0; i < header.m_freeRangeCount; i++)
+			{
+				FreeRange& range = header.m_freeRanges[i];
+				const uint64_t begin = AlignUp(range.m_begin, memoryAlignment);
+				if (begin + memorySize > range.m_end)
+					continue;
+
+				const FreeRange head = { range.m_begin, begin };
+				const FreeRange tail = { begin + memorySize, range.m_end };
+				RemoveFreeRange(header, i);
+				if (head.m_end > head.m_begin)
+					InsertFreeRange(header, head);
+				if (tail.m_end > tail.m_begin)
+					InsertFreeRange(header, tail);
+				return begin;
+			}
+
+			const uint64_t begin = AlignUp(header.m_bumpOffset, memoryAlignment);
+			if (begin + memorySize > header.m_segmentBytes)
+				return kMemoryDefault;
+			if (begin > header.m_bumpOffset)
+				InsertFreeRange(header, { header.m_bumpOffset, begin });
+			header.m_bumpOffset = begin + memorySize;
+			return begin;
+		}
+		inline Memory Offset(Memory memoryIn, Size blockSize)
+		{
+			return memoryIn + blockSize;
+		}
+		inline Size Distance(Memory memoryBase, Memory memoryIn)
+		{
+			return static_cast<Size>(memoryIn - memoryBase);
+		}
+		void Free(Memory memory, Size memorySize)
+		{
+			if (memory == kMemoryDefault)
+				return;
+			SegmentHeader& header = Header();
+			SegmentLock lock(header);
+			InsertFreeRange(header, { memory, memory + AlignUp(memorySize, kAlignment) });
+		}
+		inline void Copy(Memory destination, Memory source, Size memorySize)
+		{
+			memcpy(Pointer(destination), Pointer(source), memorySize);
+		}
+		inline void Zero(Memory destination, Size memorySize)
+		{
+			memset(Pointer(destination), 0, memorySize);
+		}
+
+		//Shared pages aren't freed by MADV_DONTNEED, MADV_REMOVE punches them out of the segment. Lazy purging has no shared equivalent.
+		void Purge(Memory memory, Size memorySize, PurgeMode purgeMode)
+		{
+#if defined(__linux__) && defined(MADV_REMOVE)
+			if (purgeMode != PurgeMode::Now)
+				return;
+			const Size pageSize = static_cast<Size>(sysconf(_SC_PAGESIZE));
+			const uint64_t begin = AlignUp(memory, pageSize);
+			const uint64_t end = (memory + memorySize) & ~uint64_t(pageSize - 1);
+			if (end > begin)
+				madvise(m_pBase + begin, end - begin, MADV_REMOVE);
+#else
+			(void)memory;
+			(void)memorySize;
+			(void)purgeMode;
+#endif
+		}
+
+	private:
+		static constexpr uint64_t kMagic = 0x4D454D4853424C4Bull;
+		static constexpr uint32_t kVersion = 2;
+
+		static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free, "Process shared atomics must be lock free");
+		static_assert((kReturnRingCapacity & (kReturnRingCapacity - 1)) == 0, "kReturnRingCapacity must be a power of two");
+
+		struct FreeRange
+		{
+			uint64_t m_begin;
+			uint64_t m_end;
+		};
+
+		struct ReturnCell
+		{
+			std::atomic<uint64_t> m_sequence;
+			uint64_t m_memory;
+			uint64_t m_size;
+		};
+
+		//Bounded multi producer single consumer queue, the consumer is the process owning the slot
+		struct ReturnRing
+		{
+			alignas(64) std::atomic<uint64_t> m_enqueue;
+			alignas(64) std::atomic<uint64_t> m_dequeue;
+			ReturnCell m_cells[kReturnRingCapacity];
+		};
+
+		//Lives at offset 0 of the segment, blocks are never handed out below m_headerBytes
+		struct SegmentHeader
+		{
+			std::atomic<uint64_t> m_magic;		//Published last by the creator
+			uint32_t m_version;
+			uint32_t m_headerBytes;
+			uint64_t m_segmentBytes;
+			std::atomic<uint32_t> m_processSlots;
+#if defined(_WIN32)
+			std::atomic<uint32_t> m_lock;
+#else
+			pthread_mutex_t m_mutex;		//Process shared and robust
+#endif
+
+			//Guarded by the lock
+			uint64_t m_bumpOffset;
+			uint64_t m_leakedBytes;
+			uint32_t m_freeRangeCount;
+			FreeRange m_freeRanges[kMaxFreeRanges];		//Sorted and coalesced
+
+			ReturnRing m_returnRings[kMaxProcesses];
+		};
+
+		class SegmentLock
+		{
+		public:
+			explicit SegmentLock(SegmentHeader& header) : m_header(header)
+			{
+#if defined(_WIN32)
+				while (m_header.m_lock.exchange(1, std::memory_order_acquire) != 0)
+				{
+					while (m_header.m_lock.load(std::memory_order_relaxed) != 0)
+						std::this_thread::yield();
+				}
+#else
+				if (pthread_mutex_lock(&m_header.m_mutex) == EOWNERDEAD)
+				{
+					RepairFreeRanges(m_header);
+					pthread_mutex_consistent(&m_header.m_mutex);
+				}
+#endif
+			}
+			~SegmentLock()
+			{
+#if defined(_WIN32)
+				m_header.m_lock.store(0, std::memory_order_release);
+#else
+				pthread_mutex_unlock(&m_header.m_mutex);
+#endif
+			}
+		private:
+			SegmentHeader& m_header;
+		};
+
+		static inline uint64_t AlignUp(uint64_t value, uint64_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+
+		inline SegmentHeader& Header() const { return *reinterpret_cast<SegmentHeader*>(m_pBase); }
+
+		static void RemoveFreeRange(SegmentHeader& header, uint32_t rangeIdx)
+		{
+			std::memmove(&header.m_freeRanges[rangeIdx], &header.m_freeRanges[rangeIdx + 1], (header.m_freeRangeCount - rangeIdx - 1) * sizeof(FreeRange));
+			header.m_freeRangeCount--;
+		}
+
+		//Coalesces with its neighbours and gives a range touching the untouched end back to it
+		static void InsertFreeRange(SegmentHeader& header, FreeRange range)
+		{
+			uint32_t insertIdx = 0;
+			while (insertIdx < header.m_freeRangeCount && header.m_freeRanges[insertIdx].m_begin < range.m_begin)
+				insertIdx++;
+
+			if (insertIdx > 0 && header.m_freeRanges[insertIdx - 1].m_end == range.m_begin)
+			{
+				range.m_begin = header.m_freeRanges[insertIdx - 1].m_begin;
+				RemoveFreeRange(header, --insertIdx);
+			}
+			if (insertIdx < header.m_freeRangeCount && header.m_freeRanges[insertIdx].m_begin == range.m_end)
+			{
+				range.m_end = header.m_freeRanges[insertIdx].m_end;
+				RemoveFreeRange(header, insertIdx);
+			}
+
+			if (range.m_end == header.m_bumpOffset)
+			{
+				header.m_bumpOffset = range.m_begin;
+				return;
+			}
+			if (header.m_freeRangeCount == kMaxFreeRanges)
+			{
+				header.m_leakedBytes += range.m_end - range.m_begin;
+				return;
+			}
+			std::memmove(&header.m_freeRanges[insertIdx + 1], &header.m_freeRanges[insertIdx], (header.m_freeRangeCount - insertIdx) * sizeof(FreeRange));
+			header.m_freeRanges[insertIdx] = range;
+			header.m_freeRangeCount++;
+		}
+
+		//Run when the lock holder died. Every update is a single store apart from the memmoves in RemoveFreeRange and InsertFreeRange,
+		//which leave a range duplicated or shifted out of the count when cut short. Keeping only ranges that are in order, inside the
+		//handed out part of the segment and clear of the previous one undoes that. A range the dead process had taken out of the table
+		//but not yet put back stays lost, nothing records its size.
+		static void RepairFreeRanges(SegmentHeader& header)
+		{
+			if (header.m_bumpOffset < header.m_headerBytes || header.m_bumpOffset > header.m_segmentBytes)
+			{
+				header.m_bumpOffset = header.m_segmentBytes;
+				header.m_freeRangeCount = 0;
+				return;
+			}
+			const uint32_t rangeCount = (std::min)(header.m_freeRangeCount, kMaxFreeRanges);
+			uint64_t previousEnd = header.m_headerBytes;
+			uint32_t keptCount = 0;
+			for (uint32_t i = 0; i < rangeCount; i++)
+			{
+				const FreeRange range = header.m_freeRanges[i];
+				if (range.m_begin < previousEnd || range.m_end <= range.m_begin || range.m_end > header.m_bumpOffset)
+					continue;
+				header.m_freeRanges[keptCount++] = range;
+				previousEnd = range.m_end;
+			}
+			header.m_freeRangeCount = keptCount;
+		}
+
+#if defined(_WIN32)
+		bool Map(HANDLE mapping, Size segmentSize, bool bCreate)
+		{
+			void* pBase = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, segmentSize);
+			if (pBase == nullptr)
+			{
+				CloseHandle(mapping);
+				return false;
+			}
+			if (segmentSize == 0)
+			{
+				MEMORY_BASIC_INFORMATION info;
+				VirtualQuery(pBase, &info, sizeof(info));
+				segmentSize = info.RegionSize;
+			}
+			m_mapping = mapping;
+			return Initialise(static_cast<char*>(pBase), segmentSize, bCreate);
+		}
+#else
+		bool Map(int fd, Size segmentSize, bool bCreate)
+		{
+			void* pBase = segmentSize > sizeof(SegmentHeader) ? mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+			if (pBase == MAP_FAILED)
+			{
+				close(fd);
+				return false;
+			}
+			m_fd = fd;
+			return Initialise(static_cast<char*>(pBase), segmentSize, bCreate);
+		}
+#endif
+
+		//New segments read back as zero, so only the non zero fields need writing before the magic is published
+		bool Initialise(char* pBase, Size segmentSize, bool bCreate)
+		{
+			m_pBase = pBase;
+			m_segmentSize = segmentSize;
+			SegmentHeader& header = Header();
+			if (bCreate)
+			{
+				header.m_version = kVersion;
+				header.m_headerBytes = static_cast<uint32_t>(AlignUp(sizeof(SegmentHeader), kAlignment));
+				header.m_segmentBytes = segmentSize;
+				header.m_bumpOffset = header.m_headerBytes;
+#if !defined(_WIN32)
+				pthread_mutexattr_t mutexAttributes;
+				pthread_mutexattr_init(&mutexAttributes);
+				pthread_mutexattr_setpshared(&mutexAttributes, PTHREAD_PROCESS_SHARED);
+				pthread_mutexattr_setrobust(&mutexAttributes, PTHREAD_MUTEX_ROBUST);
+				const int initResult = pthread_mutex_init(&header.m_mutex, &mutexAttributes);
+				pthread_mutexattr_destroy(&mutexAttributes);
+				if (initResult != 0)
+				{
+					Detach();
+					return false;
+				}
+#endif
+				for (auto& ring : header.m_returnRings)
+				{
+					for (uint64_t i = 0; i < kReturnRingCapacity; i++)
+						ring.m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+				}
+				header.m_magic.store(kMagic, std::memory_order_release);
+			}
+			else if (header.m_magic.load(std::memory_order_acquire) != kMagic || header.m_version != kVersion || header.m_segmentBytes > segmentSize)
+			{
+				Detach();
+				return false;
+			}
+
+			uint32_t claimedSlots = header.m_processSlots.load(std::memory_order_relaxed);
+			for (uint32_t slot = 0; slot < kMaxProcesses; slot++)
+			{
+				if (claimedSlots & (1u << slot))
+					continue;
+				claimedSlots = header.m_processSlots.fetch_or(1u << slot, std::memory_order_acq_rel);
+				if ((claimedSlots & (1u << slot)) == 0)
+				{
+					m_processSlot = slot;
+					break;
+				}
+			}
+			//Anything still queued was returned to a previous holder of the slot, those blocks went with it
+			DrainReturned([](Memory, Size) {});
+			return true;
+		}
+
+		char* m_pBase = nullptr;
+		Size m_segmentSize = 0;
+		uint32_t m_processSlot = kNoProcess;
+#if defined(_WIN32)
+		HANDLE m_mapping = nullptr;
+#else
+		int m_fd = -1;
+#endif
+	};
+}
@@ -1,7 +1,16 @@
 #include "MemoryAllocator.h"
+#include "Benchmarks.h"
 #include <iostream>
-int main()
+#include <cstring>
+int main(int argc, char** argv)
 {
+	//MemoryAllocator --bench [name]
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+	{
+		Benchmarks::Run(std::cout, argc > 2 ? argv[2] : nullptr);
+		return 0;
+	}
+
 	Templated::CPPAllocator cppAllocator;
 	Templated::MemoryAllocator<Templated::CPPAllocator> memoryPools(cppAllocator);
 	memoryPools.DebugPrint(std::cout, false);
@@ -12,4 +21,4 @@ int main()
 	}
 	memoryPools.DebugPrint(std::cout, true);
 	return 0;
-}
\ No newline at end of file
+}